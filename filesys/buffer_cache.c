@@ -0,0 +1,248 @@
+/* buffer_cache.c: Sector cache between the file system and its disk.
+ *
+ * Every sector the file system reads or writes goes through a cache of
+ * CACHE_SIZE sectors, replaced by the clock algorithm.  Writes only mark
+ * an entry dirty; it is written back when it is replaced or when the
+ * cache, or the entry alone, is flushed.
+ *
+ * CACHE_LOCK protects the mapping from sectors to entries and the clock
+ * state.  Each entry also has its own lock, held while its data is being
+ * read, copied or written, so accesses to different sectors proceed in
+ * parallel.  An entry in use is pinned, which keeps it from being
+ * replaced until its user is done with it.
+ *
+ * The journal holds the sectors of its running transaction, which
+ * pins them and keeps flushes from writing them until they have been
+ * committed to the log. */
+
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+struct cache_entry {
+	disk_sector_t sector;       /* Cached sector, if IN_USE. */
+	bool in_use;                /* Holds a sector. */
+	bool valid;                 /* DATA holds the sector's contents. */
+	bool dirty;                 /* DATA is newer than the disk. */
+	bool accessed;              /* Used since the clock hand passed. */
+	bool held;                  /* Not to be written back for now. */
+	int pin_cnt;                /* Users of the entry. */
+	struct lock lock;           /* Protects VALID, DIRTY and DATA. */
+	uint8_t *data;              /* DISK_SECTOR_SIZE bytes. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned;   /* An entry's PIN_CNT hit 0. */
+static size_t hand;                       /* Clock hand. */
+
+void
+buffer_cache_init (void) {
+	uint8_t *data = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+			CACHE_SIZE * DISK_SECTOR_SIZE / PGSIZE);
+
+	lock_init (&cache_lock);
+	cond_init (&cache_unpinned);
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		lock_init (&cache[i].lock);
+		cache[i].data = data + i * DISK_SECTOR_SIZE;
+	}
+}
+
+/* Returns the entry caching SECTOR, or a null pointer. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	for (size_t i = 0; i < CACHE_SIZE; i++)
+		if (cache[i].in_use && cache[i].sector == sector)
+			return &cache[i];
+	return NULL;
+}
+
+/* Chooses an entry to replace with the clock algorithm, writes it back
+ * if dirty and returns it.  Waits if every entry is pinned.  The write
+ * happens under CACHE_LOCK, so no one can read the old sector from the
+ * disk before it is up to date. */
+static struct cache_entry *
+evict (void) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	for (;;) {
+		/* Two rounds clear every accessed bit. */
+		for (size_t i = 0; i < 2 * CACHE_SIZE; i++) {
+			struct cache_entry *e = &cache[hand];
+
+			hand = (hand + 1) % CACHE_SIZE;
+			if (e->pin_cnt > 0)
+				continue;
+			if (e->in_use && e->accessed) {
+				e->accessed = false;
+				continue;
+			}
+			if (e->in_use && e->dirty)
+				disk_write (filesys_disk, e->sector, e->data);
+			e->in_use = false;
+			e->dirty = false;
+			return e;
+		}
+		cond_wait (&cache_unpinned, &cache_lock);
+	}
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held.  If
+ * FILL, its data is read from the disk if not cached yet; otherwise the
+ * caller is about to overwrite all of it. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool fill) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	e = lookup (sector);
+	if (e == NULL) {
+		e = evict ();
+		e->sector = sector;
+		e->in_use = true;
+		e->valid = false;
+	}
+	e->pin_cnt++;
+	e->accessed = true;
+	lock_release (&cache_lock);
+
+	lock_acquire (&e->lock);
+	if (fill && !e->valid) {
+		disk_read (filesys_disk, sector, e->data);
+		e->valid = true;
+	}
+	return e;
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e) {
+	lock_release (&e->lock);
+	lock_acquire (&cache_lock);
+	if (--e->pin_cnt == 0)
+		cond_signal (&cache_unpinned, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes at offset OFS in SECTOR into BUFFER. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer, size_t ofs,
+		size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, true);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS in SECTOR.  The sector is
+ * only read from the disk first if the write does not cover it. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	e->valid = true;
+	e->dirty = true;
+	cache_put (e);
+}
+
+/* Fills SECTOR with zeros. */
+void
+buffer_cache_zero (disk_sector_t sector) {
+	struct cache_entry *e = cache_get (sector, false);
+
+	memset (e->data, 0, DISK_SECTOR_SIZE);
+	e->valid = true;
+	e->dirty = true;
+	cache_put (e);
+}
+
+/* Brings SECTOR into the cache, if it is not there yet. */
+void
+buffer_cache_prefetch (disk_sector_t sector) {
+	cache_put (cache_get (sector, true));
+}
+
+/* Writes entry E back to the disk if it is dirty.  CACHE_LOCK must be
+ * held; it is released. */
+static void
+flush_entry (struct cache_entry *e) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	if (!e->in_use) {
+		lock_release (&cache_lock);
+		return;
+	}
+	e->pin_cnt++;
+	lock_release (&cache_lock);
+
+	lock_acquire (&e->lock);
+	if (e->dirty && !e->held) {
+		disk_write (filesys_disk, e->sector, e->data);
+		e->dirty = false;
+	}
+	cache_put (e);
+}
+
+/* Writes SECTOR back to the disk now if it is cached and dirty. */
+void
+buffer_cache_flush_sector (disk_sector_t sector) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	e = lookup (sector);
+	if (e != NULL)
+		flush_entry (e);
+	else
+		lock_release (&cache_lock);
+}
+
+/* Keeps SECTOR in the cache, and from being written back, until
+ * buffer_cache_unhold() is called for it. */
+void
+buffer_cache_hold (disk_sector_t sector) {
+	struct cache_entry *e = cache_get (sector, false);
+
+	ASSERT (!e->held);
+	e->held = true;
+	lock_release (&e->lock);            /* Stays pinned. */
+}
+
+/* Lets SECTOR, held by buffer_cache_hold(), be written back again. */
+void
+buffer_cache_unhold (disk_sector_t sector) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	e = lookup (sector);
+	lock_release (&cache_lock);
+	ASSERT (e != NULL && e->held);
+
+	lock_acquire (&e->lock);
+	e->held = false;
+	cache_put (e);
+}
+
+/* Writes every dirty entry that is not held back to the disk. */
+void
+buffer_cache_flush (void) {
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		lock_acquire (&cache_lock);
+		flush_entry (&cache[i]);
+	}
+}
@@ -0,0 +1,157 @@
+/* dcache.c: Cache of directory lookups.
+ *
+ * Maps (directory inode sector, name) to the inode sector the name
+ * refers to, or to 0 if the directory has no such name, so that a
+ * repeated lookup reads no directory blocks at all.  The cache holds
+ * DCACHE_SIZE entries and replaces the least recently used one.
+ *
+ * The directory code invalidates a name whenever it adds or removes it.
+ * A lookup that misses reads the directory without holding the cache
+ * lock, so it could race with such an update; it therefore notes the
+ * cache's generation before reading, and its result is only inserted
+ * if no invalidation happened in between. */
+
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "threads/synch.h"
+
+/* Number of cached names. */
+#define DCACHE_SIZE 256
+
+struct dentry {
+	struct hash_elem hash_elem;         /* Element in TABLE, if IN_TABLE. */
+	struct list_elem lru_elem;          /* Element in LRU. */
+	bool in_table;                      /* Holds a name. */
+	disk_sector_t dir;                  /* Directory inode sector. */
+	char name[NAME_MAX + 1];            /* Name within DIR. */
+	disk_sector_t sector;               /* Inode sector, or 0 if none. */
+};
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash table;
+static struct list lru;                 /* Most recently used first. */
+static struct lock dcache_lock;
+static unsigned generation;             /* Bumped by every invalidation. */
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+	return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+	return a->dir != b->dir ? a->dir < b->dir : strcmp (a->name, b->name) < 0;
+}
+
+void
+dcache_init (void) {
+	hash_init (&table, dentry_hash, dentry_less, NULL);
+	list_init (&lru);
+	lock_init (&dcache_lock);
+	for (size_t i = 0; i < DCACHE_SIZE; i++)
+		list_push_back (&lru, &dentries[i].lru_elem);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer. */
+static struct dentry *
+find (disk_sector_t dir, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+	key.dir = dir;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&table, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Drops entry D from the table and makes it the next to be reused. */
+static void
+drop (struct dentry *d) {
+	hash_delete (&table, &d->hash_elem);
+	d->in_table = false;
+	list_remove (&d->lru_elem);
+	list_push_back (&lru, &d->lru_elem);
+}
+
+/* Looks NAME up in directory DIR.  If it is cached, stores the inode
+ * sector it names, or 0 if DIR has no such name, in *SECTOR and returns
+ * true.  Otherwise returns false and stores in *GEN the value to pass
+ * to dcache_insert() once the directory has been read. */
+bool
+dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *sector,
+		unsigned *gen) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	lock_acquire (&dcache_lock);
+	d = find (dir, name);
+	if (d != NULL) {
+		*sector = d->sector;
+		list_remove (&d->lru_elem);
+		list_push_front (&lru, &d->lru_elem);
+	} else
+		*gen = generation;
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Records that NAME in directory DIR refers to inode SECTOR, or is
+ * absent if SECTOR is 0, as read from the directory after
+ * dcache_lookup() returned GEN. */
+void
+dcache_insert (disk_sector_t dir, const char *name, disk_sector_t sector,
+		unsigned gen) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	if (gen == generation && find (dir, name) == NULL) {
+		d = list_entry (list_back (&lru), struct dentry, lru_elem);
+		if (d->in_table)
+			drop (d);
+		d->dir = dir;
+		strlcpy (d->name, name, sizeof d->name);
+		d->sector = sector;
+		d->in_table = true;
+		hash_insert (&table, &d->hash_elem);
+		list_remove (&d->lru_elem);
+		list_push_front (&lru, &d->lru_elem);
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Forgets NAME in directory DIR. */
+void
+dcache_invalidate (disk_sector_t dir, const char *name) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	generation++;
+	if (strlen (name) <= NAME_MAX && (d = find (dir, name)) != NULL)
+		drop (d);
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every name in directory DIR, whose sector is being reused. */
+void
+dcache_invalidate_dir (disk_sector_t dir) {
+	lock_acquire (&dcache_lock);
+	generation++;
+	for (size_t i = 0; i < DCACHE_SIZE; i++)
+		if (dentries[i].in_table && dentries[i].dir == dir)
+			drop (&dentries[i]);
+	lock_release (&dcache_lock);
+}
@@ -1,11 +1,43 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
+/* Directory layouts.
+ *
+ * A directory starts out as a plain array of entries that is searched
+ * linearly.  Once it has no free slot left among LINEAR_MAX entries, it
+ * is rewritten in hashed layout: sector 0 holds a header in its first
+ * slot, and sector B + 1 holds bucket B, an array of BUCKET_ENTRIES
+ * entries for the names that hash to B.  A lookup then reads a single
+ * bucket whatever the size of the directory.
+ *
+ * The buckets grow by linear hashing, one bucket at a time, so that
+ * each step writes only a couple of sectors and fits in one journal
+ * operation.  With N buckets and S the largest INITIAL_BUCKETS * 2^K
+ * not above N, a name goes to bucket H mod 2S of its hash H if that is
+ * below N, and to bucket H mod S otherwise.  Growing to N + 1 buckets
+ * splits bucket N - S: the entries that now hash to N are copied into
+ * the new bucket and left in N - S too.  An entry counts only in the
+ * bucket its name hashes to, and a slot holding one that does not is
+ * free.  The directory is thus consistent after every write: the new
+ * bucket is written before the header that makes it visible. */
+#define LINEAR_MAX 32
+#define BUCKET_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define INITIAL_BUCKETS 4
+#define MAX_BUCKETS 4096
+
+/* Identifies the header of a hashed directory.  Not a valid sector
+ * number, so no entry of a linear directory looks like a header. */
+#define HASHED_MAGIC 0x48534944
+
 /* A directory. */
 struct dir {
 	struct inode *inode;                /* Backing store. */
@@ -19,10 +51,75 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* First slot of a hashed directory.  Laid out like a free entry. */
+struct dir_header {
+	uint32_t magic;                     /* HASHED_MAGIC. */
+	uint32_t bucket_cnt;                /* Number of buckets. */
+	char unused[NAME_MAX + 1 - sizeof (uint32_t)];
+	bool in_use;                        /* Always false. */
+};
+
+/* Returns the number of buckets of DIR, or 0 if DIR is linear. */
+static size_t
+bucket_cnt (const struct dir *dir) {
+	struct dir_header h;
+
+	if (inode_read_at (dir->inode, &h, sizeof h, 0) != sizeof h
+			|| h.in_use || h.magic != HASHED_MAGIC)
+		return 0;
+	return h.bucket_cnt;
+}
+
+/* Returns the offset of bucket B in a hashed directory. */
+static off_t
+bucket_ofs (size_t b) {
+	return (b + 1) * DISK_SECTOR_SIZE;
+}
+
+/* Returns the largest INITIAL_BUCKETS * 2^K not above BUCKETS, the
+ * number of buckets at the start of the current round of splits. */
+static size_t
+split_level (size_t buckets) {
+	size_t level = INITIAL_BUCKETS;
+
+	while (level * 2 <= buckets)
+		level *= 2;
+	return level;
+}
+
+/* Returns the bucket for NAME among BUCKETS buckets. */
+static size_t
+name_bucket (const char *name, size_t buckets) {
+	uint64_t hash = hash_string (name);
+	size_t level = split_level (buckets);
+	size_t b = hash % (level * 2);
+
+	return b < buckets ? b : hash % level;
+}
+
+/* Returns true if E is an entry of bucket B among BUCKETS buckets, as
+ * opposed to a free slot or a copy left behind by a split. */
+static bool
+in_bucket (const struct dir_entry *e, size_t b, size_t buckets) {
+	return e->in_use && name_bucket (e->name, buckets) == b;
+}
+
+/* Reads bucket B of DIR into BUCKET. */
+static void
+read_bucket (const struct dir *dir, size_t b,
+		struct dir_entry bucket[BUCKET_ENTRIES]) {
+	off_t size = BUCKET_ENTRIES * sizeof *bucket;
+	off_t n = inode_read_at (dir->inode, bucket, size, bucket_ofs (b));
+
+	if (n < size)
+		memset ((uint8_t *) bucket + n, 0, size - n);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
+	dcache_invalidate_dir (sector);
 	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -32,6 +129,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_set_metadata (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -71,19 +169,31 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+/* Searches DIR, taken to have BUCKETS buckets, for a file with the
+ * given NAME.  Works like lookup(). */
 static bool
-lookup (const struct dir *dir, const char *name,
+lookup_in (const struct dir *dir, size_t buckets, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
 	struct dir_entry e;
 	size_t ofs;
 
-	ASSERT (dir != NULL);
-	ASSERT (name != NULL);
+	if (buckets > 0) {
+		struct dir_entry bucket[BUCKET_ENTRIES];
+		size_t b = name_bucket (name, buckets);
+		off_t bofs = bucket_ofs (b);
+
+		read_bucket (dir, b, bucket);
+		for (size_t i = 0; i < BUCKET_ENTRIES; i++)
+			if (in_bucket (&bucket[i], b, buckets)
+					&& !strcmp (name, bucket[i].name)) {
+				if (ep != NULL)
+					*ep = bucket[i];
+				if (ofsp != NULL)
+					*ofsp = bofs + i * sizeof e;
+				return true;
+			}
+		return false;
+	}
 
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
@@ -97,6 +207,34 @@ lookup (const struct dir *dir, const char *name,
 	return false;
 }
 
+/* Searches DIR for a file with the given NAME.
+ * If successful, returns true, sets *EP to the directory entry
+ * if EP is non-null, and sets *OFSP to the byte offset of the
+ * directory entry if OFSP is non-null.
+ * otherwise, returns false and ignores EP and OFSP.
+ *
+ * Without the update lock, the layout may change between reading the
+ * header and reading the entries, which can hide NAME.  Every change
+ * grows the number of buckets, so the search is repeated until that
+ * number holds still. */
+static bool
+lookup (const struct dir *dir, const char *name,
+		struct dir_entry *ep, off_t *ofsp) {
+	size_t buckets, seen;
+	bool found;
+
+	ASSERT (dir != NULL);
+	ASSERT (name != NULL);
+
+	buckets = bucket_cnt (dir);
+	do {
+		seen = buckets;
+		found = lookup_in (dir, buckets, name, ep, ofsp);
+		buckets = bucket_cnt (dir);
+	} while (buckets != seen);
+	return found;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
@@ -105,18 +243,199 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
 	struct dir_entry e;
+	disk_sector_t dir_sector, sector;
+	unsigned gen;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
+	dir_sector = inode_get_inumber (dir->inode);
+	if (!dcache_lookup (dir_sector, name, &sector, &gen)) {
+		sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+		dcache_insert (dir_sector, name, sector, gen);
+	}
+	*inode = sector != 0 ? inode_open (sector) : NULL;
 
 	return *inode != NULL;
 }
 
+/* Returns the number of the CNT entries in ENTRIES that hash to bucket
+ * B among BUCKETS buckets, storing them in BUCKET if it is not null. */
+static size_t
+collect_bucket (const struct dir_entry *entries, size_t cnt, size_t b,
+		size_t buckets, struct dir_entry bucket[BUCKET_ENTRIES]) {
+	size_t n = 0;
+
+	for (size_t i = 0; i < cnt; i++)
+		if (name_bucket (entries[i].name, buckets) == b) {
+			if (bucket != NULL && n < BUCKET_ENTRIES)
+				bucket[n] = entries[i];
+			n++;
+		}
+	return n;
+}
+
+/* Rewrites linear directory DIR in hashed layout with INITIAL_BUCKETS
+ * buckets.  Returns false if memory or disk space runs out, or if the
+ * entries do not fit, in which case DIR stays linear. */
+static bool
+make_hashed (struct dir *dir) {
+	struct dir_entry *entries, *image, *bucket;
+	struct dir_entry e;
+	size_t cnt = 0, b;
+	size_t bucket_size = sizeof e * BUCKET_ENTRIES;
+	off_t image_size = bucket_ofs (0) + bucket_size;
+	bool success = false;
+
+	ASSERT (sizeof (struct dir_header) == sizeof (struct dir_entry));
+
+	/* Buckets 1 and up would overwrite entries past the first two
+	 * sectors, which only a directory that failed to switch has. */
+	if (inode_length (dir->inode) > bucket_ofs (1))
+		return false;
+
+	/* Collect the entries in use.  A linear directory is small. */
+	entries = malloc (inode_length (dir->inode));
+	image = calloc (1, image_size);
+	if (entries == NULL || image == NULL)
+		goto done;
+	for (off_t ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs)
+			== sizeof e; ofs += sizeof e)
+		if (e.in_use)
+			entries[cnt++] = e;
+	for (b = 0; b < INITIAL_BUCKETS; b++)
+		if (collect_bucket (entries, cnt, b, INITIAL_BUCKETS, NULL)
+				> BUCKET_ENTRIES)
+			goto done;
+
+	/* Bucket 0 shares the directory's first two sectors with the linear
+	 * entries, so it goes last, in a single write with the header.  The
+	 * others are built in its place. */
+	bucket = (void *) ((uint8_t *) image + bucket_ofs (0));
+	for (b = INITIAL_BUCKETS - 1; b > 0; b--) {
+		memset (bucket, 0, bucket_size);
+		collect_bucket (entries, cnt, b, INITIAL_BUCKETS, bucket);
+		if (inode_write_at (dir->inode, bucket, bucket_size, bucket_ofs (b))
+				!= (off_t) bucket_size)
+			goto done;
+	}
+	memset (bucket, 0, bucket_size);
+	collect_bucket (entries, cnt, 0, INITIAL_BUCKETS, bucket);
+	*(struct dir_header *) image = (struct dir_header) {
+		.magic = HASHED_MAGIC, .bucket_cnt = INITIAL_BUCKETS,
+	};
+	success = inode_write_at (dir->inode, image, image_size, 0) == image_size;
+
+done:
+	free (image);
+	free (entries);
+	return success;
+}
+
+/* Adds bucket BUCKETS to hashed directory DIR, which has BUCKETS
+ * buckets, by splitting the next bucket in turn.  Returns false if
+ * memory or disk space runs out. */
+static bool
+split_bucket (struct dir *dir, size_t buckets) {
+	size_t bucket_size = sizeof (struct dir_entry) * BUCKET_ENTRIES;
+	struct dir_entry *old = malloc (2 * bucket_size);
+	struct dir_entry *new = old + BUCKET_ENTRIES;
+	size_t from = buckets - split_level (buckets), n = 0;
+	struct dir_header h = {
+		.magic = HASHED_MAGIC, .bucket_cnt = buckets + 1,
+	};
+	bool success = false;
+
+	if (old == NULL)
+		return false;
+
+	/* Readers keep using BUCKETS buckets, which still hold every entry,
+	 * until the header changes. */
+	read_bucket (dir, from, old);
+	memset (new, 0, bucket_size);
+	for (size_t i = 0; i < BUCKET_ENTRIES; i++)
+		if (in_bucket (&old[i], from, buckets)
+				&& name_bucket (old[i].name, buckets + 1) == buckets)
+			new[n++] = old[i];
+	if (inode_write_at (dir->inode, new, bucket_size, bucket_ofs (buckets))
+			== (off_t) bucket_size)
+		success = inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+
+	free (old);
+	return success;
+}
+
+/* Grows DIR by one step: switches a linear directory to hashed layout,
+ * or adds a bucket to a hashed one.  Returns false if DIR cannot grow.
+ * The caller must hold DIR's update lock. */
+static bool
+grow (struct dir *dir) {
+	size_t buckets = bucket_cnt (dir);
+
+	if (buckets == 0)
+		return make_hashed (dir);
+	return buckets < MAX_BUCKETS && split_bucket (dir, buckets);
+}
+
+/* Sets *OFSP to the offset of a slot where an entry for NAME can go in
+ * DIR, and returns true, if there is one.  A linear directory returns
+ * false, with *OFSP set to its first free slot or its end, once it is
+ * past LINEAR_MAX entries. */
+static bool
+free_slot (const struct dir *dir, const char *name, off_t *ofsp) {
+	size_t buckets = bucket_cnt (dir);
+	struct dir_entry e;
+	off_t ofs;
+
+	if (buckets > 0) {
+		struct dir_entry bucket[BUCKET_ENTRIES];
+		size_t b = name_bucket (name, buckets);
+
+		read_bucket (dir, b, bucket);
+		for (size_t i = 0; i < BUCKET_ENTRIES; i++)
+			if (!in_bucket (&bucket[i], b, buckets)) {
+				*ofsp = bucket_ofs (b) + i * sizeof e;
+				return true;
+			}
+		return false;
+	}
+
+	/* Set OFS to offset of free slot.
+	 * If there are no free slots, then it will be set to the
+	 * current end-of-file.
+
+	 * inode_read_at() will only return a short read at end of file.
+	 * Otherwise, we'd need to verify that we didn't get a short
+	 * read due to something intermittent such as low memory. */
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e)
+		if (!e.in_use)
+			break;
+	*ofsp = ofs;
+	return ofs < (off_t) (LINEAR_MAX * sizeof e);
+}
+
+/* Grows DIR until there is a free slot for NAME, each step in a journal
+ * operation of its own, so that the following dir_add() has no more
+ * than an entry to write.  Must be called outside of any journal
+ * operation. */
+void
+dir_make_room (struct dir *dir, const char *name) {
+	bool more = true;
+	off_t ofs;
+
+	ASSERT (dir != NULL);
+	ASSERT (name != NULL);
+
+	while (more) {
+		journal_begin ();
+		inode_lock (dir->inode);
+		more = !free_slot (dir, name, &ofs) && grow (dir);
+		inode_unlock (dir->inode);
+		journal_end ();
+	}
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
  * INODE_SECTOR.
@@ -137,28 +456,34 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 
 	/* Check that NAME is not in use. */
+	journal_begin ();
+	inode_lock (dir->inode);
 	if (lookup (dir, name, NULL, NULL))
 		goto done;
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
-
-	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
+
+	/* dir_make_room() normally left a slot for NAME.  Otherwise grow the
+	 * directory by a single step, which keeps this operation small.  A
+	 * linear directory that cannot switch layout grows at its end. */
+	if (!free_slot (dir, name, &ofs)) {
+		bool linear = bucket_cnt (dir) == 0;
+
+		if (grow (dir) ? !free_slot (dir, name, &ofs) : !linear)
+			goto done;
+	}
+
+	/* Write slot. */
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
 done:
+	/* Only after the directory changed, so that no lookup can cache
+	 * what it read before. */
+	dcache_invalidate (inode_get_inumber (dir->inode), name);
+	inode_unlock (dir->inode);
+	journal_end ();
 	return success;
 }
 
@@ -176,6 +501,8 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
+	journal_begin ();
+	inode_lock (dir->inode);
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
 
@@ -188,12 +515,15 @@ dir_remove (struct dir *dir, const char *name) {
 	e.in_use = false;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
+	dcache_invalidate (inode_get_inumber (dir->inode), name);
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	inode_unlock (dir->inode);
+	journal_end ();
 	inode_close (inode);
 	return success;
 }
@@ -204,10 +534,24 @@ done:
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
-
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+	size_t buckets = bucket_cnt (dir);
+
+	while (true) {
+		/* In a hashed directory, skip the header sector and the unused
+		 * tail of each bucket, and stop after the last bucket. */
+		if (buckets > 0) {
+			if (dir->pos < DISK_SECTOR_SIZE
+					|| dir->pos % DISK_SECTOR_SIZE
+					>= (off_t) (BUCKET_ENTRIES * sizeof e))
+				dir->pos = ROUND_UP (dir->pos + 1, DISK_SECTOR_SIZE);
+			if (dir->pos >= bucket_ofs (buckets))
+				break;
+		}
+		if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+			break;
 		dir->pos += sizeof e;
-		if (e.in_use) {
+		if (buckets > 0 ? in_bucket (&e, dir->pos / DISK_SECTOR_SIZE - 1,
+					buckets) : e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
 			return true;
 		}
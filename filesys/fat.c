@@ -1,6 +1,9 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -22,14 +25,22 @@ struct fat_fs {
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;        /* Where to look for a free cluster next. */
 	struct lock write_lock;
+	struct bitmap *free_map;    /* One bit per cluster, set if in use. */
+	struct bitmap *loaded;      /* One bit per FAT sector, set if read. */
+	struct bitmap *dirty;       /* One bit per FAT sector, set if changed. */
 };
 
+/* FAT entries in one FAT sector. */
+#define ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_table_init (bool fresh);
+static cluster_t *fat_entry (cluster_t clst);
 
 void
 fat_init (void) {
@@ -51,33 +62,46 @@ fat_init (void) {
 	fat_fs_init ();
 }
 
+/* Sets up the in-memory FAT without reading it: FAT sectors are read
+ * on first use, so mounting costs the same on any disk size. */
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
+	fat_table_init (false);
+}
 
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+/* Writes the changed FAT sectors into the running journal
+ * transaction.  Each sector is copied out under the write lock and
+ * journaled without it, since journal_write() may commit, which calls
+ * back here. */
+void
+fat_flush (void) {
+	uint8_t *bounce;
+	size_t sec = 0;
+
+	if (fat_fs == NULL || fat_fs->dirty == NULL)
+		return;
+	bounce = calloc (1, DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		PANIC ("FAT flush failed");
+
+	lock_acquire (&fat_fs->write_lock);
+	while ((sec = bitmap_scan (fat_fs->dirty, sec, 1, true)) != BITMAP_ERROR) {
+		cluster_t first = sec * ENTRIES_PER_SECTOR;
+		size_t cnt = fat_fs->fat_length - first < ENTRIES_PER_SECTOR
+			? fat_fs->fat_length - first : ENTRIES_PER_SECTOR;
+
+		memcpy (bounce, &fat_fs->fat[first], cnt * sizeof (cluster_t));
+		bitmap_reset (fat_fs->dirty, sec);
+		lock_release (&fat_fs->write_lock);
+
+		journal_write (fat_fs->bs.fat_start + sec, bounce, 0,
+				cnt * sizeof (cluster_t));
+
+		lock_acquire (&fat_fs->write_lock);
+		sec++;
 	}
+	lock_release (&fat_fs->write_lock);
+	free (bounce);
 }
 
 void
@@ -87,30 +111,11 @@ fat_close (void) {
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
+	journal_write (FAT_BOOT_SECTOR, bounce, 0, DISK_SECTOR_SIZE);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
+	// Write the changed part of the FAT; the caller commits it.
+	fat_flush ();
 }
 
 void
@@ -120,30 +125,26 @@ fat_create (void) {
 	fat_fs_init ();
 
 	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	fat_table_init (true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
-	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
-	if (buf == NULL)
-		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
-	free (buf);
+	buffer_cache_zero (cluster_to_sector (ROOT_DIR_CLUSTER));
 }
 
 void
 fat_boot_create (void) {
+	/* The journal takes the end of the disk. */
+	unsigned int total_sectors = journal_start ();
 	unsigned int fat_sectors =
-	    (disk_size (filesys_disk) - 1)
+	    (total_sectors - 1)
 	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
 	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
-	    .total_sectors = disk_size (filesys_disk),
+	    .total_sectors = total_sectors,
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
@@ -152,7 +153,76 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Clusters start right after the FAT.  Cluster 0 is not backed by
+	 * any sector, so that 0 can mean "no cluster". */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER + 1;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Allocates the in-memory FAT.  If FRESH, it is a new, empty FAT that
+ * is entirely written out on the next flush; otherwise each FAT sector
+ * is read from disk when first needed.  Clusters of FAT sectors not yet
+ * read count as in use in the free cluster bitmap until they are. */
+static void
+fat_table_init (bool fresh) {
+	free (fat_fs->fat);
+	bitmap_destroy (fat_fs->free_map);
+	bitmap_destroy (fat_fs->loaded);
+	bitmap_destroy (fat_fs->dirty);
+
+	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	fat_fs->free_map = bitmap_create (fat_fs->fat_length);
+	fat_fs->loaded = bitmap_create (fat_fs->bs.fat_sectors);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->fat == NULL || fat_fs->free_map == NULL
+			|| fat_fs->loaded == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT load failed");
+
+	bitmap_set_all (fat_fs->free_map, !fresh);
+	bitmap_set_all (fat_fs->loaded, fresh);
+	bitmap_set_all (fat_fs->dirty, fresh);
+	bitmap_mark (fat_fs->free_map, 0);
+}
+
+/* Reads FAT sector SEC into the in-memory FAT and records which of its
+ * clusters are free.  write_lock must be held. */
+static void
+fat_load_sector (size_t sec) {
+	cluster_t first = sec * ENTRIES_PER_SECTOR;
+	size_t cnt = fat_fs->fat_length - first < ENTRIES_PER_SECTOR
+		? fat_fs->fat_length - first : ENTRIES_PER_SECTOR;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+	buffer_cache_read (fat_fs->bs.fat_start + sec, &fat_fs->fat[first], 0,
+			cnt * sizeof (cluster_t));
+	for (size_t i = 0; i < cnt; i++)
+		if (first + i != 0)
+			bitmap_set (fat_fs->free_map, first + i, fat_fs->fat[first + i] != 0);
+	bitmap_mark (fat_fs->loaded, sec);
+}
+
+/* Returns CLST's FAT entry, reading its FAT sector in if needed.
+ * write_lock must be held. */
+static cluster_t *
+fat_entry (cluster_t clst) {
+	size_t sec = clst / ENTRIES_PER_SECTOR;
+
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	if (!bitmap_test (fat_fs->loaded, sec))
+		fat_load_sector (sec);
+	return &fat_fs->fat[clst];
+}
+
+/* Sets CLST's FAT entry to VAL and marks its FAT sector dirty.
+ * write_lock must be held. */
+static void
+fat_set (cluster_t clst, cluster_t val) {
+	*fat_entry (clst) = val;
+	bitmap_set (fat_fs->free_map, clst, val != 0);
+	bitmap_mark (fat_fs->dirty, clst / ENTRIES_PER_SECTOR);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -164,30 +234,72 @@ fat_fs_init (void) {
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	size_t new;
+
+	lock_acquire (&fat_fs->write_lock);
+	/* Next fit: continue from the last allocation, which keeps chains
+	 * that grow together contiguous, and wrap around once.  If every
+	 * FAT sector read so far is full, read another. */
+	for (;;) {
+		size_t sec;
+
+		new = bitmap_scan (fat_fs->free_map, fat_fs->last_clst, 1, false);
+		if (new == BITMAP_ERROR)
+			new = bitmap_scan (fat_fs->free_map, 1, 1, false);
+		if (new != BITMAP_ERROR)
+			break;
+		sec = bitmap_scan (fat_fs->loaded, 0, 1, false);
+		if (sec == BITMAP_ERROR) {
+			lock_release (&fat_fs->write_lock);
+			return 0;
+		}
+		fat_load_sector (sec);
+	}
+	fat_set (new, EOChain);
+	if (clst != 0)
+		fat_set (clst, new);
+	fat_fs->last_clst = new + 1 < fat_fs->fat_length ? new + 1 : 1;
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_set (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = *fat_entry (clst);
+		fat_set (clst, 0);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	fat_set (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t val;
+
+	lock_acquire (&fat_fs->write_lock);
+	val = *fat_entry (clst);
+	lock_release (&fat_fs->write_lock);
+	return val;
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
 }
@@ -1,13 +1,23 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Bytes read ahead of a sequential reader. */
+#define READAHEAD_BYTES (16 * DISK_SECTOR_SIZE)
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
+	struct lock pos_lock;       /* Protects POS, LAST_END and RA_END.
+	                               Page faults read with file_read_at(),
+	                               so never take it. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	off_t last_end;             /* Where the last read ended. */
+	off_t ra_end;               /* Where readahead so far ends. */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -18,6 +28,7 @@ file_open (struct inode *inode) {
 	struct file *file = calloc (1, sizeof *file);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
+		lock_init (&file->pos_lock);
 		file->pos = 0;
 		file->deny_write = false;
 		return file;
@@ -71,8 +82,26 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	bool sequential;
+	off_t bytes_read;
+
+	lock_acquire (&file->pos_lock);
+	sequential = file->pos == file->last_end && file->pos > 0;
+	bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_read;
+	file->last_end = file->pos;
+
+	/* A read that continues the last one is likely followed by more:
+	 * keep READAHEAD_BYTES ahead of it. */
+	if (sequential && bytes_read > 0) {
+		off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+		off_t end = file->pos + READAHEAD_BYTES;
+		if (start < end) {
+			inode_readahead (file->inode, start, end - start);
+			file->ra_end = end;
+		}
+	}
+	lock_release (&file->pos_lock);
 	return bytes_read;
 }
 
@@ -95,8 +124,12 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written;
+
+	lock_acquire (&file->pos_lock);
+	bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
+	lock_release (&file->pos_lock);
 	return bytes_written;
 }
 
@@ -113,6 +146,16 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes the IOVCNT buffers IOV, one after the other, into FILE,
+ * starting at offset FILE_OFS in the file, in a single pass.
+ * Returns the number of bytes actually written.
+ * The file's current position is unaffected. */
+off_t
+file_writev_at (struct file *file, const struct iovec *iov, int iovcnt,
+		off_t file_ofs) {
+	return inode_writev_at (file->inode, iov, iovcnt, file_ofs);
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
@@ -149,7 +192,9 @@ void
 file_seek (struct file *file, off_t new_pos) {
 	ASSERT (file != NULL);
 	ASSERT (new_pos >= 0);
+	lock_acquire (&file->pos_lock);
 	file->pos = new_pos;
+	lock_release (&file->pos_lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
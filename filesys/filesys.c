@@ -2,9 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
+#include "filesys/dcache.h"
+#include "filesys/fat.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
 
@@ -21,7 +26,11 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
+	pagecache_init ();
 	inode_init ();
+	dcache_init ();
+	journal_init (format);
 
 #ifdef EFILESYS
 	fat_init ();
@@ -51,6 +60,7 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+	journal_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -60,14 +70,29 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
+	struct dir *dir;
+	bool success;
+
+	dir = dir_open_root ();
+	if (dir != NULL)
+		dir_make_room (dir, name);
+	journal_begin ();
+	if (dir != NULL && !free_map_allocate (1, &inode_sector)
+			&& free_map_pending ()) {
+		/* Released sectors become free only at a commit, which cannot
+		 * happen inside the operation. */
+		journal_end ();
+		free_map_sync ();
+		journal_begin ();
+		free_map_allocate (1, &inode_sector);
+	}
+	success = (dir != NULL && inode_sector != 0
 			&& inode_create (inode_sector, initial_size)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
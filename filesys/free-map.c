@@ -1,21 +1,85 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+
+/* The free map is written to its file only when the journal commits,
+ * which the background flusher has it do every second and shutdown
+ * does last, rather than on every allocation.  New allocations thus
+ * reach the disk in the same transaction as the inodes that use them,
+ * and a released sector stays allocated on disk, and unavailable,
+ * until the transaction that dropped it has been committed. */
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *released;      /* Released since the last sync. */
+static size_t released_cnt;          /* Number of bits set in RELEASED. */
+static size_t next_fit;              /* Where goal-less searches start. */
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+/* Sectors around the goal searched before giving up on locality. */
+#define GOAL_WINDOW 256
+
+/* No goal sector. */
+#define NO_GOAL SIZE_MAX
 
 /* Initializes the free map. */
 void
 free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
+	released = bitmap_create (disk_size (filesys_disk));
+	if (free_map == NULL || released == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	lock_init (&free_map_lock);
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, journal_start (), JOURNAL_SECTORS, true);
+}
+
+/* Returns the first of CNT free sectors, or BITMAP_ERROR.  Looks
+ * outward from GOAL, alternately after and before it, and then
+ * next-fit from where the last search ended. */
+static size_t
+find_free (size_t goal, size_t cnt) {
+	size_t size = bitmap_size (free_map);
+	size_t sector;
+
+	if (goal != NO_GOAL)
+		for (size_t d = 0; d < GOAL_WINDOW; d++) {
+			if (goal + d + cnt <= size && bitmap_none (free_map, goal + d, cnt))
+				return goal + d;
+			if (d > 0 && d <= goal && goal - d + cnt <= size
+					&& bitmap_none (free_map, goal - d, cnt))
+				return goal - d;
+		}
+
+	sector = bitmap_scan (free_map, next_fit < size ? next_fit : 0, cnt,
+			false);
+	if (sector == BITMAP_ERROR)
+		sector = bitmap_scan (free_map, 0, cnt, false);
+	return sector;
+}
+
+/* Allocates CNT consecutive sectors, preferably close to GOAL, and
+ * stores the first into *SECTORP.  Returns true if successful. */
+static bool
+allocate (size_t goal, size_t cnt, disk_sector_t *sectorp) {
+	size_t sector;
+
+	lock_acquire (&free_map_lock);
+	sector = find_free (goal, cnt);
+	if (sector != BITMAP_ERROR) {
+		bitmap_set_multiple (free_map, sector, cnt, true);
+		next_fit = sector + cnt;
+		*sectorp = sector;
+	}
+	lock_release (&free_map_lock);
+	return sector != BITMAP_ERROR;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +88,106 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	return allocate (NO_GOAL, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but places the sectors as close to GOAL
+ * as possible, so that related data stays together on disk. */
+bool
+free_map_allocate_near (disk_sector_t goal, size_t cnt,
+		disk_sector_t *sectorp) {
+	return allocate (goal, cnt, sectorp);
+}
+
+/* Allocates SECTOR from the free map if it is free.
+ * Returns true if successful, false if SECTOR was in use or
+ * out of range. */
+bool
+free_map_allocate_at (disk_sector_t sector) {
+	bool success = false;
+
+	lock_acquire (&free_map_lock);
+	if (sector < bitmap_size (free_map) && !bitmap_test (free_map, sector)) {
+		bitmap_mark (free_map, sector);
+		success = true;
 	}
-	if (sector != BITMAP_ERROR)
-		*sectorp = sector;
-	return sector != BITMAP_ERROR;
+	lock_release (&free_map_lock);
+	return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once the
+ * inode that used them has reached the disk. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	ASSERT (bitmap_none (released, sector, cnt));
+	bitmap_set_multiple (released, sector, cnt, true);
+	released_cnt += cnt;
+	lock_release (&free_map_lock);
+}
+
+/* Returns true if released sectors are waiting for a free_map_sync()
+ * to become available.  A caller that ran out of space retries after
+ * one, outside of any journal operation, since it commits. */
+bool
+free_map_pending (void) {
+	bool pending;
+
+	lock_acquire (&free_map_lock);
+	pending = released_cnt > 0;
+	lock_release (&free_map_lock);
+	return pending;
+}
+
+/* Writes the parts of the free map changed since the last call into
+ * the running journal transaction.  Called by the journal as it
+ * commits. */
+void
+free_map_write (void) {
+	if (free_map_file == NULL)
+		return;
+
+	lock_acquire (&free_map_lock);
+	bitmap_write_dirty (free_map, free_map_file);
+	lock_release (&free_map_lock);
+}
+
+/* Commits the journal, and with it the free map, and then frees the
+ * sectors released before the commit started.  Those released later
+ * may belong to operations that this commit leaves out, so they wait
+ * for the next sync. */
+void
+free_map_sync (void) {
+	struct bitmap *sync;
+	size_t sector;
+
+	/* Take the sectors released so far, unless out of memory, in which
+	 * case they wait too. */
+	sync = bitmap_create (bitmap_size (released));
+	if (sync != NULL) {
+		lock_acquire (&free_map_lock);
+		for (sector = bitmap_scan (released, 0, 1, true);
+				sector != BITMAP_ERROR;
+				sector = bitmap_scan (released, sector + 1, 1, true)) {
+			bitmap_reset (released, sector);
+			bitmap_mark (sync, sector);
+		}
+		released_cnt = 0;
+		lock_release (&free_map_lock);
+	}
+
+	journal_commit ();
+
+	if (sync == NULL)
+		return;
+	lock_acquire (&free_map_lock);
+	for (sector = bitmap_scan (sync, 0, 1, true);
+			sector != BITMAP_ERROR;
+			sector = bitmap_scan (sync, sector + 1, 1, true))
+		bitmap_reset (free_map, sector);
+	lock_release (&free_map_lock);
+	bitmap_destroy (sync);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -50,6 +196,7 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_metadata (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
 }
@@ -57,7 +204,10 @@ free_map_open (void) {
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_sync ();
+	journal_commit ();
 	file_close (free_map_file);
+	free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,6 +222,7 @@ free_map_create (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_metadata (file_get_inode (free_map_file));
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
 }
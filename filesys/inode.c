@@ -1,22 +1,72 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include <uio.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-/* On-disk inode.
+/* A run of LENGTH consecutive sectors of a file, starting at sector
+ * OFS of the file, stored in consecutive disk sectors from START.
+ * A file is a list of extents sorted by OFS; sectors of the file not
+ * covered by any extent are holes that read as zeros. */
+struct extent {
+	uint32_t ofs;                       /* First file sector. */
+	disk_sector_t start;                /* First disk sector. */
+	uint32_t length;                    /* Number of sectors. */
+};
+
+/* Extents held in the inode itself and in each overflow extent block. */
+#define INODE_EXTENT_CNT 41
+#define BLOCK_EXTENT_CNT \
+	((DISK_SECTOR_SIZE - sizeof (disk_sector_t)) / sizeof (struct extent))
+
+/* Overflow extent block.  The extents past the inode's own are kept in
+ * a chain of these, as many as the file needs, each holding the
+ * BLOCK_EXTENT_CNT extents that follow the previous one's.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct extent_block {
+	struct extent extents[BLOCK_EXTENT_CNT];
+	disk_sector_t next;                 /* Next block, or 0. */
+	uint8_t unused[DISK_SECTOR_SIZE - sizeof (disk_sector_t)
+		- BLOCK_EXTENT_CNT * sizeof (struct extent)];
+};
+
+/* Bytes of a small file kept in the inode itself, in place of its
+ * extents. */
+#define INLINE_MAX (INODE_EXTENT_CNT * sizeof (struct extent))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in the inode. */
+
+/* Sectors reserved past the end of a file that is being extended. */
+#define PREALLOC_CNT 8
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * A file of at most INLINE_MAX bytes is created with INODE_INLINE set
+ * and its data in INLINE_DATA, so that it needs no sector of its own
+ * and is read along with its inode.  It moves to a data sector when it
+ * grows past INLINE_MAX. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents. */
+	disk_sector_t overflow;             /* First extent block, or 0. */
+	union {
+		struct extent extents[INODE_EXTENT_CNT]; /* First extents. */
+		uint8_t inline_data[INLINE_MAX];  /* Data, if INODE_INLINE. */
+	};
+	uint32_t flags;                     /* INODE_* flags. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -26,37 +76,374 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+ * OPEN_CNT is protected by the lock of the open inode table stripe the
+ * inode is in; METADATA is only ever set, once, when the inode is
+ * opened; the members after LOCK are protected by LOCK.  RW orders
+ * reads and writes of the file's contents: each write is atomic with
+ * respect to reads, and reads proceed in parallel. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open inode table. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+	bool metadata;                      /* Contents are journaled. */
+	struct rwlock rw;                   /* Contents lock. */
+	struct lock update_lock;            /* See inode_lock(). */
+	struct lock lock;                   /* Protects the members below. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	bool dirty;                         /* DATA differs from the disk inode. */
 	struct inode_disk data;             /* Inode content. */
+	struct extent_block **blocks;       /* Extent blocks, in chain order. */
+	size_t block_cnt;                   /* Number of extent blocks. */
+	disk_sector_t prealloc_start;       /* Sectors reserved for appends. */
+	size_t prealloc_cnt;                /* Number of reserved sectors. */
 };
 
+/* Returns true if INODE's data is stored in the inode itself. */
+static bool
+is_inline (const struct inode *inode) {
+	return inode->data.flags & INODE_INLINE;
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS in data sector SECTOR of
+ * INODE, through the journal if INODE holds metadata. */
+static void
+write_sector (struct inode *inode, disk_sector_t sector, const void *buffer,
+		int ofs, int size) {
+	if (inode->metadata)
+		journal_write (sector, buffer, ofs, size);
+	else
+		buffer_cache_write (sector, buffer, ofs, size);
+}
+
+/* Returns extent I of INODE. */
+static struct extent *
+extent_at (struct inode *inode, size_t i) {
+	if (i < INODE_EXTENT_CNT)
+		return &inode->data.extents[i];
+	i -= INODE_EXTENT_CNT;
+	return &inode->blocks[i / BLOCK_EXTENT_CNT]->extents[i % BLOCK_EXTENT_CNT];
+}
+
+/* Returns the sector of INODE's extent block B. */
+static disk_sector_t
+block_sector (struct inode *inode, size_t b) {
+	return b == 0 ? inode->data.overflow : inode->blocks[b - 1]->next;
+}
+
+/* Writes the extent blocks of INODE that hold extents FIRST to LAST,
+ * inclusive. */
+static void
+write_extent_blocks (struct inode *inode, size_t first, size_t last) {
+	size_t b;
+
+	if (last < INODE_EXTENT_CNT)
+		return;
+	b = first < INODE_EXTENT_CNT ? 0
+		: (first - INODE_EXTENT_CNT) / BLOCK_EXTENT_CNT;
+	for (; b <= (last - INODE_EXTENT_CNT) / BLOCK_EXTENT_CNT; b++)
+		journal_write (block_sector (inode, b), inode->blocks[b], 0,
+				DISK_SECTOR_SIZE);
+}
+
+/* Adds an empty extent block to the end of INODE's chain.  Returns
+ * false if memory or disk space runs out. */
+static bool
+add_extent_block (struct inode *inode) {
+	struct extent_block **blocks, *block;
+	disk_sector_t sector;
+
+	blocks = realloc (inode->blocks, (inode->block_cnt + 1) * sizeof *blocks);
+	if (blocks == NULL)
+		return false;
+	inode->blocks = blocks;
+	block = calloc (1, sizeof *block);
+	if (block == NULL)
+		return false;
+	if (!free_map_allocate_near (inode->sector, 1, &sector)) {
+		free (block);
+		return false;
+	}
+
+	if (inode->block_cnt == 0) {
+		inode->data.overflow = sector;
+		inode->dirty = true;
+	} else {
+		size_t last = inode->block_cnt - 1;
+		inode->blocks[last]->next = sector;
+		journal_write (block_sector (inode, last), inode->blocks[last], 0,
+				DISK_SECTOR_SIZE);
+	}
+	inode->blocks[inode->block_cnt++] = block;
+	return true;
+}
+
+/* Reads the chain of extent blocks of INODE into memory.  Returns false
+ * if memory runs out. */
+static bool
+read_extent_blocks (struct inode *inode) {
+	disk_sector_t sector;
+
+	for (sector = inode->data.overflow; sector != 0;
+			sector = inode->blocks[inode->block_cnt - 1]->next) {
+		struct extent_block **blocks = realloc (inode->blocks,
+				(inode->block_cnt + 1) * sizeof *blocks);
+		struct extent_block *block;
+
+		if (blocks == NULL)
+			return false;
+		inode->blocks = blocks;
+		block = malloc (sizeof *block);
+		if (block == NULL)
+			return false;
+		buffer_cache_read (sector, block, 0, DISK_SECTOR_SIZE);
+		inode->blocks[inode->block_cnt++] = block;
+	}
+	return true;
+}
+
+/* Frees the in-memory extent blocks of INODE. */
+static void
+free_extent_blocks (struct inode *inode) {
+	for (size_t b = 0; b < inode->block_cnt; b++)
+		free (inode->blocks[b]);
+	free (inode->blocks);
+	inode->blocks = NULL;
+	inode->block_cnt = 0;
+}
+
+/* Returns the index of the last extent of INODE that starts at or
+ * before file sector IDX, or -1 if there is none. */
+static int
+find_extent (struct inode *inode, uint32_t idx) {
+	int lo = 0, hi = inode->data.extent_cnt;
+
+	/* Extents below LO start at or before IDX, those from HI on after
+	 * it. */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (extent_at (inode, mid)->ofs <= idx)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/* Gives INODE's unused preallocated sectors back to the free map. */
+static void
+release_prealloc (struct inode *inode) {
+	if (inode->prealloc_cnt > 0)
+		free_map_release (inode->prealloc_start, inode->prealloc_cnt);
+	inode->prealloc_cnt = 0;
+}
+
+/* Allocates a data sector for INODE, at GOAL if possible.  A sector
+ * from INODE's preallocation window is used when it is the goal;
+ * otherwise the window moves to the sectors following the new one, so
+ * that writers appending to different files at once each keep a run of
+ * their own instead of interleaving sector by sector.  Returns 0 if the
+ * disk is full. */
+static disk_sector_t
+allocate_sector (struct inode *inode, disk_sector_t goal) {
+	disk_sector_t sector;
+
+	if (inode->prealloc_cnt > 0 && inode->prealloc_start == goal) {
+		inode->prealloc_start++;
+		inode->prealloc_cnt--;
+		return goal;
+	}
+
+	release_prealloc (inode);
+	if (!free_map_allocate_near (goal, 1, &sector))
+		return 0;
+	inode->prealloc_start = sector + 1;
+	while (inode->prealloc_cnt < PREALLOC_CNT
+			&& free_map_allocate_at (sector + 1 + inode->prealloc_cnt))
+		inode->prealloc_cnt++;
+	return sector;
+}
+
+/* Allocates a disk sector for file sector IDX of INODE, which is not
+ * mapped and follows extent I (-1 if it precedes every extent).  The
+ * goal is the disk sector where IDX would be if extent I went on to
+ * cover it, or the sector after the inode for a file's first sector.
+ * When the allocation lands right after extent I, the extent simply
+ * grows, so appends stay contiguous on disk; otherwise a new extent is
+ * inserted after I, in a new extent block if the last one is full.
+ * Returns the zeroed sector, or 0 if memory or disk space runs out. */
+static disk_sector_t
+extent_grow (struct inode *inode, int i, uint32_t idx) {
+	struct inode_disk *data = &inode->data;
+	struct extent *e = i >= 0 ? extent_at (inode, i) : NULL;
+	disk_sector_t goal = e != NULL ? e->start + (idx - e->ofs)
+		: inode->sector + 1;
+	disk_sector_t sector = allocate_sector (inode, goal);
+
+	if (sector == 0)
+		return 0;
+	if (e != NULL && e->ofs + e->length == idx && sector == goal) {
+		e->length++;
+		write_extent_blocks (inode, i, i);
+	} else {
+		if (data->extent_cnt
+				== INODE_EXTENT_CNT + inode->block_cnt * BLOCK_EXTENT_CNT
+				&& !add_extent_block (inode))
+			goto fail;
+		for (int j = data->extent_cnt; j > i + 1; j--)
+			*extent_at (inode, j) = *extent_at (inode, j - 1);
+		*extent_at (inode, i + 1) = (struct extent) {
+			.ofs = idx, .start = sector, .length = 1,
+		};
+		data->extent_cnt++;
+		write_extent_blocks (inode, i + 1, data->extent_cnt - 1);
+	}
+	inode->dirty = true;
+	buffer_cache_zero (sector);
+	return sector;
+
+fail:
+	free_map_release (sector, 1);
+	return 0;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, allocating it if CREATE.
+ * Returns 0 if the sector is a hole, or could not be allocated.
+ * INODE's lock must be held. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool create) {
+	uint32_t idx = pos / DISK_SECTOR_SIZE;
+	int i;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+	i = find_extent (inode, idx);
+	if (i >= 0) {
+		struct extent *e = extent_at (inode, i);
+		if (idx - e->ofs < e->length)
+			return e->start + (idx - e->ofs);
+	}
+	return create ? extent_grow (inode, i, idx) : 0;
+}
+
+/* Moves the data of INODE, stored inline, to a data sector of its own,
+ * which becomes its first extent.  Returns false if the disk is full.
+ * INODE's lock must be held. */
+static bool
+inline_promote (struct inode *inode) {
+	struct inode_disk *data = &inode->data;
+	disk_sector_t sector = 0;
+
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+	ASSERT (is_inline (inode) && data->extent_cnt == 0);
+
+	if (data->length > 0) {
+		sector = allocate_sector (inode, inode->sector + 1);
+		if (sector == 0)
+			return false;
+		buffer_cache_zero (sector);
+		write_sector (inode, sector, data->inline_data, 0, data->length);
+	}
+
+	memset (data->inline_data, 0, sizeof data->inline_data);
+	data->flags &= ~INODE_INLINE;
+	if (sector != 0) {
+		data->extents[0] = (struct extent) {
+			.ofs = 0, .start = sector, .length = 1,
+		};
+		data->extent_cnt = 1;
+	}
+	inode->dirty = true;
+	return true;
+}
+
+/* Allocates and zeroes SECTORS sectors for the empty inode DATA, stored
+ * at sector GOAL, in as few extents as the free map allows, and as
+ * close to GOAL as possible.  Returns false if the disk is too full or
+ * fragmented, leaving the sectors allocated so far in DATA. */
+static bool
+allocate_extents (struct inode_disk *data, disk_sector_t goal,
+		size_t sectors) {
+	size_t ofs = 0;
+
+	while (ofs < sectors) {
+		size_t cnt = sectors - ofs;
+		disk_sector_t start;
+
+		if (data->extent_cnt == INODE_EXTENT_CNT)
+			return false;
+		while (!free_map_allocate_near (goal, cnt, &start))
+			if ((cnt /= 2) == 0)
+				return false;
+		goal = start + cnt;
+		data->extents[data->extent_cnt++] = (struct extent) {
+			.ofs = ofs, .start = start, .length = cnt,
+		};
+		for (size_t i = 0; i < cnt; i++)
+			buffer_cache_zero (start + i);
+		ofs += cnt;
+	}
+	return true;
+}
+
+/* Releases every data sector of the file DATA, whose extent blocks,
+ * if any, are the BLOCK_CNT BLOCKS, and the extent blocks. */
+static void
+release_sectors (struct inode_disk *data, struct extent_block **blocks,
+		size_t block_cnt) {
+	disk_sector_t sector = data->overflow;
+
+	for (size_t i = 0; i < data->extent_cnt; i++) {
+		size_t j = i - INODE_EXTENT_CNT;
+		struct extent *e = i < INODE_EXTENT_CNT ? &data->extents[i]
+			: &blocks[j / BLOCK_EXTENT_CNT]->extents[j % BLOCK_EXTENT_CNT];
+		free_map_release (e->start, e->length);
+	}
+	for (size_t b = 0; b < block_cnt; b++) {
+		free_map_release (sector, 1);
+		sector = blocks[b]->next;
+	}
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, so that opening a single inode twice
+ * returns the same `struct inode'.  It is split by sector number into
+ * stripes, each with its own lock, so that opens and closes of
+ * different inodes seldom contend. */
+#define OPEN_STRIPES 16
+
+static struct open_stripe {
+	struct hash inodes;                 /* Open inodes, by sector. */
+	struct lock lock;                   /* Protects INODES and OPEN_CNTs. */
+} open_stripes[OPEN_STRIPES];
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
+
+/* Returns the stripe of the open inode table that holds SECTOR. */
+static struct open_stripe *
+stripe_of (disk_sector_t sector) {
+	return &open_stripes[sector % OPEN_STRIPES];
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	for (size_t i = 0; i < OPEN_STRIPES; i++) {
+		if (!hash_init (&open_stripes[i].inodes, inode_hash, inode_less, NULL))
+			PANIC ("open inode table creation failed");
+		lock_init (&open_stripes[i].lock);
+	}
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -74,23 +461,24 @@ inode_create (disk_sector_t sector, off_t length) {
 	/* If this assertion fails, the inode structure is not exactly
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct extent_block) == DISK_SECTOR_SIZE);
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
+		/* The initial LENGTH is allocated up front; later growth only
+		 * allocates the sectors actually written.  A small file needs no
+		 * sectors at all. */
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+		if (length <= (off_t) INLINE_MAX)
+			disk_inode->flags = INODE_INLINE;
+		if (disk_inode->flags & INODE_INLINE
+				|| allocate_extents (disk_inode, sector + 1,
+					bytes_to_sectors (length))) {
+			journal_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
 			success = true; 
-		} 
+		} else
+			release_sectors (disk_inode, NULL, 0);
 		free (disk_inode);
 	}
 	return success;
@@ -101,39 +489,68 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct open_stripe *stripe = stripe_of (sector);
+	struct inode key;
+	struct hash_elem *e;
 	struct inode *inode;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
+	lock_acquire (&stripe->lock);
+	key.sector = sector;
+	e = hash_find (&stripe->inodes, &key.elem);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		inode->open_cnt++;
+		lock_release (&stripe->lock);
+		return inode; 
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
 	if (inode == NULL)
-		return NULL;
+		goto fail;
+
+	/* Read the inode and its extent blocks.  The stripe stays locked,
+	 * so no one else opens it meanwhile. */
+	buffer_cache_read (sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	inode->blocks = NULL;
+	inode->block_cnt = 0;
+	inode->prealloc_cnt = 0;
+	if (!read_extent_blocks (inode)) {
+		free_extent_blocks (inode);
+		free (inode);
+		goto fail;
+	}
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
+	rw_init (&inode->rw);
+	lock_init (&inode->update_lock);
+	lock_init (&inode->lock);
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->metadata = false;
+	inode->dirty = false;
+	hash_insert (&stripe->inodes, &inode->elem);
+	lock_release (&stripe->lock);
 	return inode;
+
+fail:
+	lock_release (&stripe->lock);
+	return NULL;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		struct open_stripe *stripe = stripe_of (inode->sector);
+
+		lock_acquire (&stripe->lock);
 		inode->open_cnt++;
+		lock_release (&stripe->lock);
+	}
 	return inode;
 }
 
@@ -148,32 +565,50 @@ inode_get_inumber (const struct inode *inode) {
  * If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) {
+	struct open_stripe *stripe;
+	bool last;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	stripe = stripe_of (inode->sector);
+	lock_acquire (&stripe->lock);
+	last = --inode->open_cnt == 0;
+	if (last)
+		hash_delete (&stripe->inodes, &inode->elem);
+	lock_release (&stripe->lock);
 
+	/* Release resources if this was the last opener.  No one else can
+	 * find the inode any more. */
+	if (last) {
 		/* Deallocate blocks if removed. */
+		release_prealloc (inode);
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			release_sectors (&inode->data, inode->blocks, inode->block_cnt);
 		}
 
+		free_extent_blocks (inode);
 		free (inode); 
 	}
 }
 
+/* Marks INODE as holding file system metadata, such as a directory, so
+ * that writes to its contents are journaled like the inode itself. */
+void
+inode_set_metadata (struct inode *inode) {
+	inode->metadata = true;
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
  * has it open. */
 void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
+	lock_acquire (&inode->lock);
 	inode->removed = true;
+	lock_release (&inode->lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -183,13 +618,28 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
+	rw_acquire_read (&inode->rw);
+	if (is_inline (inode)) {
+		/* Only writers, which hold RW, change the inline data. */
+		off_t left = inode_length (inode) - offset;
+
+		bytes_read = size < left ? size : left;
+		if (bytes_read > 0)
+			memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+		else
+			bytes_read = 0;
+		size = 0;
+	}
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, false);
+		lock_release (&inode->lock);
+
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
 		off_t inode_left = inode_length (inode) - offset;
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
@@ -200,81 +650,227 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		if (sector_idx != 0)
+			buffer_cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+	rw_release_read (&inode->rw);
 
 	return bytes_read;
 }
 
+/* Queues the sectors holding the SIZE bytes of INODE from OFFSET for
+ * asynchronous reading into the buffer cache. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = offset + size < inode_length (inode)
+		? offset + size : inode_length (inode);
+
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector;
+
+		lock_acquire (&inode->lock);
+		sector = byte_to_sector (inode, offset, false);
+		lock_release (&inode->lock);
+		if (sector != 0)
+			page_cache_readahead_async (sector);
+	}
+}
+
+/* Returns the most journal slots that writing file sector IDX of
+ * INODE can take, counting the inode itself and, for a sector not yet
+ * allocated, every extent block that a new extent would shift, up to a
+ * new block at the end.  INODE's lock must be held. */
+static size_t
+write_cost (struct inode *inode, uint32_t idx) {
+	size_t cost = inode->metadata ? 2 : 1;
+	int i = find_extent (inode, idx);
+	size_t first, last = inode->data.extent_cnt;
+
+	if (i >= 0 && idx - extent_at (inode, i)->ofs
+			< extent_at (inode, i)->length)
+		return cost;
+	first = i >= 0 ? (size_t) i : 0;
+	if (last >= INODE_EXTENT_CNT) {
+		size_t b = first < INODE_EXTENT_CNT ? 0
+			: (first - INODE_EXTENT_CNT) / BLOCK_EXTENT_CNT;
+		cost += (last - INODE_EXTENT_CNT) / BLOCK_EXTENT_CNT - b + 2;
+	}
+	return cost;
+}
+
+/* Records that INODE's data now reaches END, and writes the inode
+ * through the journal if it changed.  INODE's lock must be held. */
+static void
+update_inode (struct inode *inode, off_t end) {
+	if (end > inode->data.length) {
+		inode->data.length = end;
+		inode->dirty = true;
+	}
+	if (inode->dirty) {
+		journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		inode->dirty = false;
+	}
+}
+
+/* Ends the journal operation of a write to INODE whose data reaches
+ * END so far, and starts another, so that a write too large for one
+ * transaction goes on in the next.  Readers may see the first part
+ * before the rest.  If SYNC, it commits in between, which also makes
+ * the sectors released meanwhile available.  Returns false if the write cannot go on,
+ * because it is part of a larger operation or writes were denied
+ * meanwhile, with the write locked again either way. */
+static bool
+next_operation (struct inode *inode, off_t end, bool sync) {
+	if (journal_nested ())
+		return false;
+
+	lock_acquire (&inode->lock);
+	update_inode (inode, end);
+	lock_release (&inode->lock);
+	rw_release_write (&inode->rw);
+	journal_end ();
+
+	if (sync)
+		free_map_sync ();
+
+	journal_begin ();
+	rw_acquire_write (&inode->rw);
+	return inode->deny_write_cnt == 0;
+}
+
+/* Position in the buffers of a vectored write. */
+struct iov_pos {
+	const struct iovec *iov;            /* Current buffer. */
+	size_t ofs;                         /* Offset within it. */
+};
+
+/* Returns the bytes at POS, as many as are contiguous up to SIZE, which
+ * must not exceed what is left.  Stores their number in *N and
+ * advances POS past them. */
+static const uint8_t *
+iov_take (struct iov_pos *pos, size_t size, size_t *n) {
+	const uint8_t *p;
+	size_t left;
+
+	while (pos->ofs == pos->iov->iov_len) {
+		pos->iov++;
+		pos->ofs = 0;
+	}
+	p = (const uint8_t *) pos->iov->iov_base + pos->ofs;
+	left = pos->iov->iov_len - pos->ofs;
+	*n = size < left ? size : left;
+	pos->ofs += *n;
+	return p;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or an error occurs.
+ * A write past end of file extends the inode.  Sectors skipped over
+ * are left as holes. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
 		off_t offset) {
-	const uint8_t *buffer = buffer_;
-	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	struct iovec iov = { (void *) buffer, size };
+	return inode_writev_at (inode, &iov, 1, offset);
+}
 
-	if (inode->deny_write_cnt)
+/* Like inode_write_at(), but writes the IOVCNT buffers IOV, one after
+ * the other, in a single pass.
+ *
+ * Each sector is written only once the journal has room for it, if
+ * need be in a new operation.  A write nested in a larger operation
+ * stops short instead, as does one that needs more room than an empty
+ * transaction has.  A write that runs out of disk space while
+ * released sectors wait for a commit retries once after one. */
+off_t
+inode_writev_at (struct inode *inode, const struct iovec *iov, int iovcnt,
+		off_t offset) {
+	struct iov_pos pos = { iov, 0 };
+	off_t size = 0, bytes_written = 0;
+	size_t n;
+	int retries = 0;
+	bool synced = false;
+
+	for (int i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	journal_begin ();
+	rw_acquire_write (&inode->rw);
+	if (inode->deny_write_cnt) {
+		rw_release_write (&inode->rw);
+		journal_end ();
 		return 0;
+	}
+
+	/* A write that still fits in the inode goes there.  Any other makes
+	 * an inline file an ordinary one first. */
+	lock_acquire (&inode->lock);
+	if (is_inline (inode) && size > 0) {
+		if (offset + size <= (off_t) INLINE_MAX) {
+			for (off_t done = 0; done < size; done += n) {
+				const uint8_t *p = iov_take (&pos, size - done, &n);
+				memcpy (inode->data.inline_data + offset + done, p, n);
+			}
+			inode->dirty = true;
+			offset += size;
+			bytes_written = size;
+			size = 0;
+		} else if (!journal_reserve (2) || !inline_promote (inode))
+			size = 0;
+	}
+	lock_release (&inode->lock);
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
+		bool room;
+
+		lock_acquire (&inode->lock);
+		room = journal_reserve (write_cost (inode, offset / DISK_SECTOR_SIZE));
+		lock_release (&inode->lock);
+		if (!room) {
+			/* Go on in a new operation, then after a commit too. */
+			if (retries == 2 || !next_operation (inode,
+						bytes_written > 0 ? offset : 0, retries++ > 0))
+				break;
+			continue;
+		}
+		retries = 0;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, true);
+		lock_release (&inode->lock);
+
+		/* Bytes left in sector. */
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
 		/* Number of bytes to actually write into this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
-			break;
-
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+		int chunk_size = size < sector_left ? size : sector_left;
+		if (sector_idx == 0) {
+			if (synced || !free_map_pending ())
+				break;
+			synced = true;
+			if (!next_operation (inode, bytes_written > 0 ? offset : 0, true))
+				break;
+			continue;
+		}
 
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+		/* The cache reads the sector in first only if it is not
+		 * cached and the chunk does not cover all of it. */
+		for (int done = 0; done < chunk_size; done += n) {
+			const uint8_t *p = iov_take (&pos, chunk_size - done, &n);
+			write_sector (inode, sector_idx, p, sector_ofs + done, n);
 		}
 
 		/* Advance. */
@@ -282,18 +878,39 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
+	lock_acquire (&inode->lock);
+	update_inode (inode, bytes_written > 0 ? offset : 0);
+	lock_release (&inode->lock);
+	rw_release_write (&inode->rw);
+	journal_end ();
 	return bytes_written;
 }
 
+/* Acquires INODE's update lock, which serializes operations made of
+ * several reads and writes of its contents, such as adding a directory
+ * entry after checking that its name is free.  Plain reads and writes
+ * do not take it. */
+void
+inode_lock (struct inode *inode) {
+	lock_acquire (&inode->update_lock);
+}
+
+/* Releases INODE's update lock. */
+void
+inode_unlock (struct inode *inode) {
+	lock_release (&inode->update_lock);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
+	lock_acquire (&inode->lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +918,11 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	lock_acquire (&inode->lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
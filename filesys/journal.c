@@ -0,0 +1,380 @@
+/* journal.c: Write-ahead journal of file system metadata.
+ *
+ * Inodes, directory contents, the free map and the FAT are written
+ * with journal_write() instead of straight into the buffer cache.  The
+ * sectors written join the running transaction and are held in the
+ * cache: they cannot reach their place on disk before the transaction
+ * has been committed.  A commit copies them into the log, the
+ * JOURNAL_SECTORS sectors at the end of the disk, with one sequential
+ * write, and then writes the log header, which is the commit point.
+ * After that the sectors are ordinary dirty cache entries and are
+ * written in place, checkpointed, whenever the cache gets to it.
+ *
+ * Commits happen about once a second, from the background flusher, so
+ * a transaction batches every metadata change made meanwhile and many
+ * small writes become one log write.  Before it writes the log, a
+ * commit writes back the rest of the cache, which both checkpoints the
+ * previous transaction, whose log is then overwritten, and makes file
+ * data reach the disk before the metadata that points to it.  A sector
+ * that is still dirty from a committed transaction is written back
+ * before the running one changes it, for the same reason.
+ *
+ * An operation that makes several related changes, such as creating a
+ * file, brackets them with journal_begin() and journal_end().  A commit
+ * waits for open operations to finish and keeps new ones from starting,
+ * so that each operation is either entirely in a transaction or not at
+ * all.  journal_begin() also reserves TX_RESERVE slots of the running
+ * transaction for the operation, and waits for a commit if they are not
+ * free, so that the transaction cannot fill up under an operation in
+ * progress.  An operation must call journal_begin() before it takes any
+ * file system lock, since it may wait there for a commit.
+ *
+ * An operation never waits for a commit once it has started, since it
+ * may hold locks that other operations need to end.  One that may
+ * write more sectors than it has left asks journal_reserve() for more
+ * first, which succeeds only if nobody has reserved them; if it fails,
+ * the operation must stop short or end and start over as a new
+ * operation, as inode_write_at() does.  Running out of slots inside an
+ * operation anyway is a bug.
+ *
+ * At boot, journal_init() replays the last committed transaction, so
+ * that after a crash the metadata is as of some commit. */
+
+#include "filesys/journal.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/buffer_cache.h"
+#include "filesys/fat.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identifies a committed log. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors in one transaction: one log sector each. */
+#define TX_MAX (JOURNAL_SECTORS - 1)
+
+/* Transaction slots reserved by each operation. */
+#define TX_RESERVE 8
+
+/* Transaction slots nobody may reserve, kept for the free map or FAT
+ * written by a commit. */
+#define HOOK_RESERVE 4
+
+/* Log header, in the first journal sector.  Log sector I + 1 holds the
+ * contents of SECTORS[I]. */
+struct journal_header {
+	uint32_t magic;                     /* JOURNAL_MAGIC if committed. */
+	uint32_t cnt;                       /* Number of sectors. */
+	disk_sector_t sectors[TX_MAX];      /* Where they belong. */
+	uint8_t unused[DISK_SECTOR_SIZE - 2 * sizeof (uint32_t)
+		- TX_MAX * sizeof (disk_sector_t)];
+};
+
+static disk_sector_t log_start;         /* First journal sector. */
+static bool ready;                      /* Journal initialized. */
+static bool log_live;                   /* Log holds a committed header. */
+
+/* Running transaction. */
+static disk_sector_t tx[TX_MAX];
+static size_t tx_cnt;
+static size_t reserved;                 /* Slots reserved and unused. */
+
+static struct lock journal_lock;        /* Protects all of the above. */
+static struct condition journal_idle;   /* Any of the below changed. */
+static int handle_cnt;                  /* Operations in progress. */
+static struct thread *committer;        /* Thread committing, or NULL. */
+
+static void write_header (size_t cnt);
+static void write_allocations (void);
+static void commit (void);
+
+/* Initializes the journal.  Unless FORMAT, replays the transaction
+ * left in the log, if any. */
+void
+journal_init (bool format) {
+	struct journal_header *h = malloc (sizeof *h);
+	uint8_t *data = malloc (DISK_SECTOR_SIZE);
+
+	ASSERT (sizeof *h == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&journal_idle);
+	log_start = journal_start ();
+
+	if (h == NULL || data == NULL)
+		PANIC ("journal initialization failed");
+	if (!format) {
+		disk_read (filesys_disk, log_start, h);
+		if (h->magic == JOURNAL_MAGIC && h->cnt <= TX_MAX) {
+			for (size_t i = 0; i < h->cnt; i++) {
+				disk_read (filesys_disk, log_start + 1 + i, data);
+				buffer_cache_write (h->sectors[i], data, 0, DISK_SECTOR_SIZE);
+			}
+			buffer_cache_flush ();
+		}
+	}
+	free (data);
+	free (h);
+
+	write_header (0);
+	ready = true;
+}
+
+/* Returns the first sector of the journal. */
+disk_sector_t
+journal_start (void) {
+	return disk_size (filesys_disk) - JOURNAL_SECTORS;
+}
+
+/* Writes a log header for the first CNT sectors of the running
+ * transaction.  A CNT of 0 empties the log. */
+static void
+write_header (size_t cnt) {
+	struct journal_header *h = calloc (1, sizeof *h);
+
+	if (h == NULL)
+		PANIC ("out of memory writing journal");
+	if (cnt > 0) {
+		h->magic = JOURNAL_MAGIC;
+		h->cnt = cnt;
+		memcpy (h->sectors, tx, cnt * sizeof *tx);
+	}
+	disk_write (filesys_disk, log_start, h);
+	log_live = cnt > 0;
+	free (h);
+}
+
+/* Returns true if CNT more slots of the running transaction can be
+ * reserved or used.  JOURNAL_LOCK must be held. */
+static bool
+tx_room (size_t cnt) {
+	return tx_cnt + reserved + cnt + HOOK_RESERVE <= TX_MAX;
+}
+
+/* Starts an operation whose journaled writes must be committed
+ * together.  Operations nest. */
+void
+journal_begin (void) {
+	struct thread *cur = thread_current ();
+
+	if (cur->journal_depth > 0 || !ready || committer == cur) {
+		cur->journal_depth++;
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	for (;;) {
+		if (committer == NULL && tx_room (TX_RESERVE))
+			break;
+		if (committer == NULL && handle_cnt == 0 && tx_cnt > 0) {
+			/* Make room by committing what is there. */
+			lock_release (&journal_lock);
+			journal_commit ();
+			lock_acquire (&journal_lock);
+		} else
+			cond_wait (&journal_idle, &journal_lock);
+	}
+	handle_cnt++;
+	reserved += TX_RESERVE;
+	cur->journal_credits = TX_RESERVE;
+	lock_release (&journal_lock);
+	cur->journal_depth++;
+}
+
+/* Ends an operation started by journal_begin(). */
+void
+journal_end (void) {
+	struct thread *cur = thread_current ();
+
+	ASSERT (cur->journal_depth > 0);
+	if (--cur->journal_depth > 0 || !ready || committer == cur)
+		return;
+
+	lock_acquire (&journal_lock);
+	reserved -= cur->journal_credits;
+	cur->journal_credits = 0;
+	handle_cnt--;
+	cond_broadcast (&journal_idle, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Makes sure that the current operation can write CNT more sectors,
+ * adding slots nobody reserved to its reservation if it has fewer left.
+ * Returns false, without waiting, if there are not enough.  Outside of
+ * an operation, writes commit as they need to, so there is always
+ * room. */
+bool
+journal_reserve (size_t cnt) {
+	struct thread *cur = thread_current ();
+	bool success = true;
+
+	if (cur->journal_depth == 0 || !ready || committer == cur
+			|| cur->journal_credits >= cnt)
+		return true;
+
+	lock_acquire (&journal_lock);
+	cnt -= cur->journal_credits;
+	if (tx_room (cnt)) {
+		cur->journal_credits += cnt;
+		reserved += cnt;
+	} else
+		success = false;
+	lock_release (&journal_lock);
+	return success;
+}
+
+/* Returns true if the current operation is nested in another, and so
+ * cannot end before that one does. */
+bool
+journal_nested (void) {
+	return thread_current ()->journal_depth > 1;
+}
+
+/* Returns true if SECTOR is part of the running transaction. */
+static bool
+in_tx (disk_sector_t sector) {
+	for (size_t i = 0; i < tx_cnt; i++)
+		if (tx[i] == sector)
+			return true;
+	return false;
+}
+
+/* Takes a slot of the running transaction for the current thread,
+ * from its reservation while anything is left of it.  JOURNAL_LOCK must
+ * be held. */
+static void
+take_slot (void) {
+	struct thread *cur = thread_current ();
+
+	if (cur->journal_credits > 0) {
+		cur->journal_credits--;
+		reserved--;
+		return;
+	}
+	if (committer == cur) {
+		/* Writing the free map or the FAT.  Only a free map or FAT
+		 * changed in more sectors than HOOK_RESERVE gets split. */
+		if (tx_cnt == TX_MAX)
+			commit ();
+		return;
+	}
+
+	if (cur->journal_depth > 0) {
+		/* Slots nobody reserved, if any are left. */
+		if (!tx_room (1))
+			PANIC ("journal operation ran past its reservation");
+		return;
+	}
+	while (!tx_room (1)) {
+		lock_release (&journal_lock);
+		journal_commit ();
+		lock_acquire (&journal_lock);
+	}
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS in SECTOR, as part of
+ * the running transaction. */
+void
+journal_write (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	if (!ready) {
+		buffer_cache_write (sector, buffer, ofs, size);
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	if (!in_tx (sector)) {
+		take_slot ();
+		/* Write back what a committed transaction left, whose log is
+		 * overwritten by the next commit. */
+		buffer_cache_flush_sector (sector);
+		buffer_cache_hold (sector);
+		tx[tx_cnt++] = sector;
+	}
+	buffer_cache_write (sector, buffer, ofs, size);
+	lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  JOURNAL_LOCK must be held. */
+static void
+commit (void) {
+	uint8_t *data;
+
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+
+	if (tx_cnt == 0)
+		return;
+	data = malloc (DISK_SECTOR_SIZE);
+	if (data == NULL)
+		PANIC ("out of memory committing journal");
+
+	/* Checkpoint the last transaction and write back file data. */
+	buffer_cache_flush ();
+	if (log_live)
+		write_header (0);
+
+	for (size_t i = 0; i < tx_cnt; i++) {
+		buffer_cache_read (tx[i], data, 0, DISK_SECTOR_SIZE);
+		disk_write (filesys_disk, log_start + 1 + i, data);
+	}
+	write_header (tx_cnt);
+
+	for (size_t i = 0; i < tx_cnt; i++)
+		buffer_cache_unhold (tx[i]);
+	tx_cnt = 0;
+	free (data);
+}
+
+/* Writes the changes the free map or the FAT keeps in memory into the
+ * running transaction. */
+static void
+write_allocations (void) {
+#ifdef EFILESYS
+	fat_flush ();
+#else
+	free_map_write ();
+#endif
+}
+
+/* Commits the running transaction, along with the changes the free
+ * map or the FAT keeps in memory.  Waits for operations in progress
+ * to end first, so it must not be called from inside one. */
+void
+journal_commit (void) {
+	struct thread *cur = thread_current ();
+
+	if (!ready)
+		return;
+
+	ASSERT (cur->journal_depth == 0 && committer != cur);
+	lock_acquire (&journal_lock);
+	while (committer != NULL)
+		cond_wait (&journal_idle, &journal_lock);
+	committer = cur;
+	while (handle_cnt > 0)
+		cond_wait (&journal_idle, &journal_lock);
+	lock_release (&journal_lock);
+
+	write_allocations ();
+
+	lock_acquire (&journal_lock);
+	commit ();
+	committer = NULL;
+	cond_broadcast (&journal_idle, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Commits and checkpoints everything, leaving the log empty. */
+void
+journal_done (void) {
+	journal_commit ();
+	lock_acquire (&journal_lock);
+	buffer_cache_flush ();
+	if (log_live)
+		write_header (0);
+	lock_release (&journal_lock);
+}
@@ -1,9 +1,38 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * File data is cached by sector in the buffer cache (buffer_cache.c).
+ * This module runs its background work:
+ *
+ *   - A worker daemon, page_cache_kworkerd, reads sectors into the
+ *     buffer cache ahead of sequential readers, so that their next reads
+ *     find the data cached.  Readers queue the sectors they will want
+ *     with page_cache_readahead_async() and do not wait for them.
+ *
+ *   - A flusher commits the metadata journal, which also writes back the
+ *     dirty sectors, every FLUSH_INTERVAL, so that little is lost in a
+ *     crash and replacing a cache entry seldom has to write first. */
 
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "filesys/buffer_cache.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "vm/vm.h"
+
+/* Sectors that can wait for readahead at once.  More are dropped. */
+#define RA_QUEUE_SIZE 64
+
+/* Timer ticks between background flushes. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
+static void page_cache_flushd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,36 +44,109 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
-/* The initializer of file vm */
+/* Readahead queue, a ring protected by RA_LOCK.  RA_SEMA counts the
+ * queued sectors. */
+static disk_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct semaphore ra_sema;
+
+/* The initializer of file vm.  Called by both filesys_init() and, with
+ * VM, vm_init(); only the first call does anything. */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	static bool started;
+
+	if (started)
+		return;
+	started = true;
+
+	lock_init (&ra_lock);
+	sema_init (&ra_sema, 0);
+	page_cache_workerd = thread_create ("pc_kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR
+			|| thread_create ("pc_flushd", PRI_DEFAULT, page_cache_flushd,
+				NULL) == TID_ERROR)
+		PANIC ("cannot start page cache workers");
+}
+
+/* Asks the worker to read SECTOR into the buffer cache.  Does not wait,
+ * and drops the request if the queue is full or already has SECTOR. */
+void
+page_cache_readahead_async (disk_sector_t sector) {
+	bool queued = false;
+
+	lock_acquire (&ra_lock);
+	if (ra_cnt < RA_QUEUE_SIZE) {
+		for (size_t i = 0; i < ra_cnt; i++)
+			if (ra_queue[(ra_head + i) % RA_QUEUE_SIZE] == sector)
+				goto done;
+		ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+		queued = true;
+	}
+done:
+	lock_release (&ra_lock);
+	if (queued)
+		sema_up (&ra_sema);
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
-
+	return true;
 }
 
+/* No page is ever of type VM_PAGE_CACHE: file data is cached by sector
+ * in the buffer cache instead.  These operations only keep the
+ * interface complete. */
+
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
-page_cache_readahead (struct page *page, void *kva) {
+page_cache_readahead (struct page *page UNUSED, void *kva UNUSED) {
+	return false;
 }
 
 /* Utilze the Swap out mechanism to implement writeback */
 static bool
-page_cache_writeback (struct page *page) {
+page_cache_writeback (struct page *page UNUSED) {
+	return false;
 }
 
 /* Destory the page_cache. */
 static void
-page_cache_destroy (struct page *page) {
+page_cache_destroy (struct page *page UNUSED) {
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		disk_sector_t sector;
+
+		sema_down (&ra_sema);
+		lock_acquire (&ra_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+		ra_cnt--;
+		lock_release (&ra_lock);
+
+		buffer_cache_prefetch (sector);
+	}
+}
+
+/* Background flusher for dirty sectors. */
+static void
+page_cache_flushd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+#ifdef EFILESYS
+		journal_commit ();
+#else
+		free_map_sync ();
+#endif
+	}
 }
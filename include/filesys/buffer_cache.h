@@ -0,0 +1,17 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, size_t ofs, size_t size);
+void buffer_cache_write (disk_sector_t, const void *, size_t ofs, size_t size);
+void buffer_cache_zero (disk_sector_t);
+void buffer_cache_prefetch (disk_sector_t);
+void buffer_cache_flush_sector (disk_sector_t);
+void buffer_cache_hold (disk_sector_t);
+void buffer_cache_unhold (disk_sector_t);
+void buffer_cache_flush (void);
+
+#endif /* filesys/buffer_cache.h */
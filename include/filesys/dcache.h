@@ -0,0 +1,16 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+#include "filesys/directory.h"
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t dir, const char *name,
+		disk_sector_t *sector, unsigned *gen);
+void dcache_insert (disk_sector_t dir, const char *name,
+		disk_sector_t sector, unsigned gen);
+void dcache_invalidate (disk_sector_t dir, const char *name);
+void dcache_invalidate_dir (disk_sector_t dir);
+
+#endif /* filesys/dcache.h */
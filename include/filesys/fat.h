@@ -23,6 +23,7 @@ void fat_open (void);
 void fat_close (void);
 void fat_create (void);
 void fat_close (void);
+void fat_flush (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
@@ -10,8 +10,14 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_sync (void);
+bool free_map_pending (void);
+void free_map_write (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_near (disk_sector_t goal, size_t,
+		disk_sector_t *);
+bool free_map_allocate_at (disk_sector_t);
 void free_map_release (disk_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
@@ -6,6 +6,7 @@
 #include "devices/disk.h"
 
 struct bitmap;
+struct iovec;
 
 void inode_init (void);
 bool inode_create (disk_sector_t, off_t);
@@ -13,9 +14,15 @@ struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
+void inode_set_metadata (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_writev_at (struct inode *, const struct iovec *, int iovcnt,
+		off_t offset);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Sectors at the end of the disk reserved for the journal. */
+#define JOURNAL_SECTORS 33
+
+void journal_init (bool format);
+disk_sector_t journal_start (void);
+void journal_begin (void);
+void journal_end (void);
+bool journal_reserve (size_t cnt);
+bool journal_nested (void);
+void journal_write (disk_sector_t, const void *, size_t ofs, size_t size);
+void journal_commit (void);
+void journal_done (void);
+
+#endif /* filesys/journal.h */
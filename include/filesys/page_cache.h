@@ -1,12 +1,16 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include "devices/disk.h"
 
 struct page;
 enum vm_type;
 
 struct page_cache {};
 
-void page_cache_init (void);
+/* Included after struct page_cache, which vm.h embeds in struct page. */
+#include "vm/vm.h"
+
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+void page_cache_readahead_async (disk_sector_t);
 #endif
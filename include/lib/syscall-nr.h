@@ -22,6 +22,7 @@ enum {
 	/* Project 3 and optionally project 4. */
 	SYS_MMAP,                   /* Map a file into memory. */
 	SYS_MUNMAP,                 /* Remove a memory mapping. */
+	SYS_MSYNC,                  /* Write back a memory mapping. */
 
 	/* Project 4 only. */
 	SYS_CHDIR,                  /* Change the current directory. */
@@ -33,6 +34,10 @@ enum {
 
 	/* Extra for Project 2 */
 	SYS_DUP2,                   /* Duplicate the file descriptor */
+	SYS_READV,                  /* Read into several buffers. */
+	SYS_WRITEV,                 /* Write from several buffers. */
+	SYS_PREAD,                  /* Read at a given offset. */
+	SYS_PWRITE,                 /* Write at a given offset. */
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
@@ -0,0 +1,15 @@
+#ifndef __LIB_UIO_H
+#define __LIB_UIO_H
+
+#include <stddef.h>
+
+/* One buffer of a vectored read or write, for readv() and writev(). */
+struct iovec {
+	void *iov_base;             /* Start of the buffer. */
+	size_t iov_len;             /* Its size in bytes. */
+};
+
+/* Most buffers that one readv() or writev() takes. */
+#define IOV_MAX 64
+
+#endif /* lib/uio.h */
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -37,10 +38,15 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, off_t offset);
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int msync (void *addr, size_t length);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -78,4 +84,12 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+static inline long long
+dump_fault_stats (void) {
+	long long fault_cnt;
+	asm volatile ("int $0x45");
+	asm volatile ("\t movq %%rax, %0": "=r" (fault_cnt));
+	return fault_cnt;
+}
+
 #endif /* lib/user/syscall.h */
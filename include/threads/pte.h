@@ -41,5 +41,11 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MB page (page directory only). */
+
+/* Size of a huge page, mapped by a single page directory entry with
+ * PTE_PS set, and the number of pages it spans. */
+#define HPGSIZE (1UL << PDXSHIFT)
+#define HPG_CNT (HPGSIZE / (1UL << PTXSHIFT))
 
 #endif /* threads/pte.h */
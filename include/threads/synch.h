@@ -38,6 +38,22 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+	struct lock lock;           /* Protects the members below. */
+	struct condition readers_ok; /* Signaled when readers may enter. */
+	struct condition writer_ok; /* Signaled when a writer may enter. */
+	int readers;                /* Number of readers holding the lock. */
+	bool writer;                /* Held by a writer? */
+	int waiting_writers;        /* Number of writers waiting. */
+};
+
+void rw_init (struct rwlock *);
+void rw_acquire_read (struct rwlock *);
+void rw_release_read (struct rwlock *);
+void rw_acquire_write (struct rwlock *);
+void rw_release_write (struct rwlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
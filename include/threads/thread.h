@@ -133,6 +133,13 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	size_t wss;                         /* Working set estimate, in pages. */
+	unsigned vm_fault_cnt;              /* Page faults handled. */
+	uint64_t user_rsp;                  /* User rsp at system call entry. */
+#endif
+#ifdef FILESYS
+	int journal_depth;                  /* Nesting of journal_begin(). */
+	size_t journal_credits;             /* Transaction slots reserved, unused. */
 #endif
 
 	/* Owned by thread.c. */
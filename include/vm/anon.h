@@ -1,13 +1,21 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+struct zswap_entry;
+
+/* A swapped out anonymous page is either compressed in memory, in
+ * ZENTRY, or on the swap disk, in SWAP_SLOT. */
 struct anon_page {
+	size_t swap_slot;           /* Slot on the swap disk, or SIZE_MAX. */
+	struct zswap_entry *zentry; /* Compressed copy, or NULL. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_print_stats (void);
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+#include <stdbool.h>
+
+struct frame;
+
+/* A page replacement policy.
+ * Every hook is called with the frame table lock held, so a policy needs
+ * no locking of its own.  A frame is handed to the policy by FAULT once
+ * its page is mapped, and leaves it either through REMOVE (the page is
+ * being freed) or by being returned from RECLAIM. */
+struct evict_policy {
+	const char *name;
+
+	/* FRAME was just mapped to its page by a page fault. */
+	void (*fault) (struct frame *frame);
+	/* FRAME is being freed and must be forgotten. */
+	void (*remove) (struct frame *frame);
+	/* Result of sampling FRAME's accessed bit, which the sampler has
+	 * cleared.  ACCESSED is true if FRAME was used since the last
+	 * sample. */
+	void (*sample) (struct frame *frame, bool accessed);
+	/* Chooses a victim, detaches it from the policy and returns it.
+	 * Returns NULL if every frame is pinned. */
+	struct frame *(*reclaim) (void);
+};
+
+extern const struct evict_policy *evict_policy;
+
+/* Called on each frame by evict_for_each_frame().  Returning false stops
+ * the iteration. */
+typedef bool evict_frame_func (struct frame *frame, void *aux);
+
+bool evict_select_policy (const char *name);
+void evict_init (void);
+void evict_for_each_frame (evict_frame_func *func, void *aux);
+
+#endif /* vm/evict.h */
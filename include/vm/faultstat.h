@@ -0,0 +1,23 @@
+#ifndef VM_FAULTSTAT_H
+#define VM_FAULTSTAT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* How a page fault was resolved. */
+enum fault_kind {
+	FAULT_MINOR,                /* Page was mapped already or again. */
+	FAULT_ANON,                 /* First touch of anonymous memory. */
+	FAULT_UNINIT,               /* First load from an executable or file. */
+	FAULT_SWAP_IN,              /* Anonymous page read back from swap. */
+	FAULT_FILE,                 /* Evicted file page read back. */
+	FAULT_COW,                  /* First write to a zero frame mapping. */
+	FAULT_STACK,                /* Stack growth. */
+	FAULT_INVALID,              /* Not resolved, the process dies. */
+	FAULT_KIND_CNT
+};
+
+void faultstat_init (void);
+void faultstat_record (enum fault_kind, uint64_t start_tsc);
+void faultstat_print (bool histograms);
+
+#endif /* vm/faultstat.h */
@@ -1,12 +1,39 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
 enum vm_type;
 
 struct file_page {
+	struct file *file;          /* File of the page's mapping. */
+	off_t ofs;                  /* Offset of the page in FILE. */
+	size_t read_bytes;          /* Bytes of the page that lie in FILE. */
+};
+
+/* A segment of an executable whose pages are loaded lazily.  The AUX
+ * of each of its uninit pages, which share its reference to the file;
+ * each page drops its reference once it is loaded or destroyed. */
+struct load_info {
+	struct file *file;          /* Reopened file to read from. */
+	void *upage;                /* First page of the segment. */
+	off_t ofs;                  /* Offset of UPAGE in FILE. */
+	size_t read_bytes;          /* Bytes from OFS that lie in FILE. */
+	int ref_cnt;                /* Number of references. */
+};
+
+/* A mapping made by mmap().  Its pages are file-backed pages that share
+ * its reference to the file. */
+struct mmap_region {
+	void *addr;                 /* First mapped page. */
+	size_t page_cnt;            /* Number of mapped pages. */
+	struct file *file;          /* Reopened file, closed on munmap. */
+	off_t ofs;                  /* Offset of ADDR in FILE. */
+	size_t file_bytes;          /* Bytes from OFS that lie in FILE. */
+	struct list_elem elem;      /* Element in the SPT's mmaps list. */
 };
 
 void vm_file_init (void);
@@ -14,4 +41,14 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+int do_msync (void *addr, size_t length);
+bool mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+bool file_lazy_load (struct page *page, void *aux);
+struct mmap_region *mmap_find_region (void *addr);
+bool file_backed_writeback (struct page *page);
+struct load_info *load_info_create (struct file *file, off_t ofs,
+		void *upage, size_t read_bytes);
+struct load_info *load_info_ref (struct load_info *info);
+void load_info_unref (struct load_info *info);
 #endif
@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <stdint.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -20,6 +23,9 @@ enum vm_type {
 	VM_MARKER_0 = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
 
+	/* Marks the pages that back the user stack. */
+	VM_STACK = VM_MARKER_0,
+
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
 };
@@ -46,6 +52,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in the supplemental page table. */
+	struct thread *owner;       /* Process whose address space holds it. */
+	bool writable;              /* May the user write to this page? */
+	bool zero_mapped;           /* Mapped read-only to the shared zero frame. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,6 +73,11 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;      /* Element in the eviction policy's queue. */
+	int64_t last_used;          /* Tick the page was last seen accessed. */
+	int queue;                  /* Policy queue the frame is on. */
+	bool referenced;            /* Accessed bit saved by the sampler. */
+	unsigned pin_cnt;           /* Never evicted while nonzero. */
 };
 
 /* The function table for page operations.
@@ -85,6 +100,8 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;          /* Pages of the process, keyed by va. */
+	struct list mmaps;          /* Mappings made by mmap(). */
 };
 
 #include "threads/thread.h"
@@ -97,6 +114,9 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+extern size_t vm_stack_limit;
+extern size_t vm_fault_around;
+
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
@@ -107,6 +127,17 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_free_frame (struct page *page);
+bool vm_reclaim_frame (void);
+bool vm_pin_frame (struct page *page);
+void vm_unpin_frame (struct page *page);
+bool vm_prepare_user_write (void *va);
+bool vm_pin_user_page (void *va, bool write);
+void vm_unpin_user_page (void *va);
+size_t vm_clean_frames (size_t max);
+void vm_sample_working_set (struct thread *t);
+void vm_print_stats (void);
+bool vm_in_stack_region (const void *addr);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -27,6 +27,8 @@ typedef unsigned long elem_type;
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	size_t dirty_lo;    /* First element changed since last written. */
+	size_t dirty_hi;    /* One past the last changed element. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -55,6 +57,18 @@ byte_cnt (size_t bit_cnt) {
 	return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Records that the element holding bit BIT_IDX of B has changed since
+   B was last written with bitmap_write_dirty(). */
+static inline void
+note_dirty (struct bitmap *b, size_t bit_idx) {
+	size_t idx = elem_idx (bit_idx);
+
+	if (idx < b->dirty_lo)
+		b->dirty_lo = idx;
+	if (idx >= b->dirty_hi)
+		b->dirty_hi = idx + 1;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -75,6 +89,7 @@ bitmap_create (size_t bit_cnt) {
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
 		b->bits = malloc (byte_cnt (bit_cnt));
+		b->dirty_lo = b->dirty_hi = 0;
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
 			return b;
@@ -95,6 +110,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->dirty_lo = b->dirty_hi = 0;
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -148,6 +164,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
 	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	note_dirty (b, bit_idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -160,6 +177,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	note_dirty (b, bit_idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +192,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	note_dirty (b, bit_idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -326,6 +345,28 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes to FILE only the part of B that changed since the last call,
+   so that a few changed bits cost a single sector write instead of a
+   rewrite of the whole bitmap.  Returns true if successful, false
+   otherwise, in which case the changes are kept for the next call. */
+bool
+bitmap_write_dirty (struct bitmap *b, struct file *file) {
+	size_t lo = b->dirty_lo, hi = b->dirty_hi;
+	off_t ofs = lo * sizeof (elem_type);
+	off_t size = (hi - lo) * sizeof (elem_type);
+
+	if (lo >= hi)
+		return true;
+	b->dirty_lo = elem_cnt (b->bit_cnt);
+	b->dirty_hi = 0;
+	if (file_write_at (file, b->bits + lo, size, ofs) != size) {
+		note_dirty (b, lo * ELEM_BITS);
+		note_dirty (b, (hi - 1) * ELEM_BITS);
+		return false;
+	}
+	return true;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = join ("\0" x 1023, map (chr ($_ % 255 + 1), 0...199));
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,35 @@
+/* Writes a byte into every other sector of a file, leaving a hole
+   between each two, so that the file is made of far more separate
+   runs of sectors than fit in its inode and a single overflow block,
+   and checks its contents. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RUN_CNT 200
+#define STRIDE 1024
+
+static char buf[(RUN_CNT - 1) * STRIDE + 1];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("write %d runs to \"%s\"", RUN_CNT, file_name);
+  for (i = 0; i < RUN_CNT; i++) 
+    {
+      buf[i * STRIDE] = i % 255 + 1;
+      seek (fd, i * STRIDE);
+      if (write (fd, &buf[i * STRIDE], 1) != 1)
+        fail ("write at offset %zu in \"%s\" failed", i * STRIDE, file_name);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
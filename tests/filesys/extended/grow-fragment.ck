@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fragment) begin
+(grow-fragment) create "testfile"
+(grow-fragment) open "testfile"
+(grow-fragment) write 200 runs to "testfile"
+(grow-fragment) close "testfile"
+(grow-fragment) open "testfile" for verification
+(grow-fragment) verified contents of "testfile"
+(grow-fragment) close "testfile"
+(grow-fragment) end
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Writes a file with writev, overwrites part of it with pwrite and
+   reads it back with pread and readv, checking that the positional
+   calls leave the file position alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  size_t size = sizeof sample - 1;
+  size_t third = size / 3;
+  char expected[sizeof sample];
+  char buf[sizeof sample];
+  struct iovec iov[3];
+  int handle;
+
+  CHECK (create ("vector.txt", 0), "create \"vector.txt\"");
+  CHECK ((handle = open ("vector.txt")) > 1, "open \"vector.txt\"");
+
+  iov[0] = (struct iovec) { sample, third };
+  iov[1] = (struct iovec) { sample + third, 0 };
+  iov[2] = (struct iovec) { sample + third, size - third };
+  CHECK (writev (handle, iov, 3) == (int) size, "writev \"vector.txt\"");
+  CHECK (tell (handle) == size, "position is at end of file");
+
+  memcpy (expected, sample, size);
+  memset (expected + 10, 'x', 20);
+  memset (buf, 'x', 20);
+  CHECK (pwrite (handle, buf, 20, 10) == 20, "pwrite at offset 10");
+  CHECK (tell (handle) == size, "pwrite left the position alone");
+
+  memset (buf, 0, sizeof buf);
+  CHECK (pread (handle, buf, 100, 5) == 100, "pread at offset 5");
+  if (memcmp (buf, expected + 5, 100))
+    fail ("pread data differs");
+  CHECK (tell (handle) == size, "pread left the position alone");
+
+  seek (handle, 0);
+  memset (buf, 0, sizeof buf);
+  iov[0] = (struct iovec) { buf + third, size - third };
+  iov[1] = (struct iovec) { buf, third };
+  CHECK (readv (handle, iov, 2) == (int) size, "readv \"vector.txt\"");
+  if (memcmp (buf + third, expected, size - third)
+      || memcmp (buf, expected + size - third, third))
+    fail ("readv data differs");
+  CHECK (pread (handle, buf, 10, size) == 0, "pread at end of file");
+
+  close (handle);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rw-vector) begin
+(rw-vector) create "vector.txt"
+(rw-vector) open "vector.txt"
+(rw-vector) writev "vector.txt"
+(rw-vector) position is at end of file
+(rw-vector) pwrite at offset 10
+(rw-vector) pwrite left the position alone
+(rw-vector) pread at offset 5
+(rw-vector) pread left the position alone
+(rw-vector) readv "vector.txt"
+(rw-vector) pread at end of file
+(rw-vector) end
+rw-vector: exit(0)
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Checks that untouched anonymous pages share one zero frame until they
+   are written. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define CHUNK_PAGE_COUNT 3
+#define CHUNK_SIZE (CHUNK_PAGE_COUNT * PAGE_SIZE)
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void)
+{
+	size_t i;
+	void *pa;
+
+	msg ("read pages");
+	for (i = 0 ; i < CHUNK_PAGE_COUNT ; i++)
+		CHECK (buf[i*PAGE_SIZE] == 0, "check if page [%zu] reads zero", i);
+
+	pa = get_phys_addr(&buf[0]);
+	CHECK (pa != 0, "check if page is mapped");
+	for (i = 1 ; i < CHUNK_PAGE_COUNT ; i++)
+		CHECK (get_phys_addr(&buf[i*PAGE_SIZE]) == pa,
+				"check if page [%zu] shares the zero frame", i);
+
+	msg ("write page [1]");
+	buf[PAGE_SIZE] = 1;
+	CHECK (get_phys_addr(&buf[PAGE_SIZE]) != pa,
+			"check if written page has its own frame");
+	CHECK (buf[PAGE_SIZE] == 1, "check memory content");
+	CHECK (buf[0] == 0 && buf[2*PAGE_SIZE] == 0,
+			"check if other pages still read zero");
+}
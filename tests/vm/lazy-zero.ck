@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lazy-zero) begin
+(lazy-zero) read pages
+(lazy-zero) check if page [0] reads zero
+(lazy-zero) check if page [1] reads zero
+(lazy-zero) check if page [2] reads zero
+(lazy-zero) check if page is mapped
+(lazy-zero) check if page [1] shares the zero frame
+(lazy-zero) check if page [2] shares the zero frame
+(lazy-zero) write page [1]
+(lazy-zero) check if written page has its own frame
+(lazy-zero) check memory content
+(lazy-zero) check if other pages still read zero
+(lazy-zero) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Checks that reading one page of a mapped file also loads the other
+   pages of the file within the fault-around window. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/small.inc"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT ((sizeof small + PAGE_SIZE - 1) / PAGE_SIZE)
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+  size_t i;
+
+  CHECK ((handle = open ("small.txt")) > 1, "open \"small.txt\"");
+  CHECK ((map = mmap (actual, PAGE_CNT * PAGE_SIZE, 0, handle, 0))
+         != MAP_FAILED, "mmap \"small.txt\"");
+
+  msg ("read first page");
+  if (memcmp (actual, small, 10))
+    fail ("read of mmap'd file reported bad data");
+  for (i = 1; i < PAGE_CNT; i++)
+    if (get_phys_addr (actual + i * PAGE_SIZE) == 0)
+      fail ("page %zu not loaded by fault-around", i);
+
+  msg ("verify");
+  for (i = 0; i < PAGE_CNT; i++)
+    if (memcmp (actual + i * PAGE_SIZE, small + i * PAGE_SIZE, 10))
+      fail ("page %zu has bad data", i);
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-around) begin
+(mmap-around) open "small.txt"
+(mmap-around) mmap "small.txt"
+(mmap-around) read first page
+(mmap-around) verify
+(mmap-around) end
+EOF
+pass;
@@ -0,0 +1,110 @@
+/* Fills an array large enough to cover whole 2 MB windows, so that the
+   kernel may back them with huge pages, checks that one window is, and
+   checks the array from a forked child and again from the parent.
+   Then maps a file twice into the two halves of one 2 MB window, so
+   that they share a huge page, and unmaps the first half, which splits
+   it. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/sample.inc"
+
+#define SIZE (6 * 1024 * 1024)
+#define PAGE_SIZE 4096
+#define HUGE_SIZE (2 * 1024 * 1024)
+#define HUGE_PAGES (HUGE_SIZE / PAGE_SIZE)
+#define HALF (HUGE_SIZE / 2)
+#define MAP_ADDR ((char *) 0x20000000)
+
+static char buf[SIZE];
+
+/* Fails unless every page of BUF holds its own index. */
+static void
+verify (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE / PAGE_SIZE; i++)
+    if (*(size_t *) (buf + i * PAGE_SIZE) != i)
+      fail ("page %zu corrupted", i);
+}
+
+/* Returns true if page I of the 2 MB window at BASE is at physical
+   address P + I * PAGE_SIZE, for P that of the first, as in a huge
+   page. */
+static bool
+contiguous (char *base)
+{
+  char *pa = get_phys_addr (base);
+  size_t i;
+
+  for (i = 0; i < HUGE_PAGES; i++)
+    if ((char *) get_phys_addr (base + i * PAGE_SIZE) != pa + i * PAGE_SIZE)
+      return false;
+  return true;
+}
+
+/* Returns the marker stored at the end of page I of the mapped
+   window. */
+static size_t *
+marker (size_t i)
+{
+  return (size_t *) (MAP_ADDR + (i + 1) * PAGE_SIZE) - 1;
+}
+
+void
+test_main (void)
+{
+  char *window;
+  bool found = false;
+  void *pa;
+  pid_t child;
+  size_t i;
+  int fd;
+
+  msg ("fill");
+  for (i = 0; i < SIZE / PAGE_SIZE; i++)
+    *(size_t *) (buf + i * PAGE_SIZE) = i;
+
+  window = (char *) (((uintptr_t) buf + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+  for (; window + HUGE_SIZE <= buf + SIZE; window += HUGE_SIZE)
+    if (contiguous (window))
+      found = true;
+  CHECK (found, "a 2 MB window of the array is physically contiguous");
+
+  msg ("verify in child");
+  child = fork ("child");
+  if (child == 0)
+    {
+      verify ();
+      exit (0);
+    }
+  CHECK (wait (child) == 0, "wait for child");
+
+  msg ("verify in parent");
+  verify ();
+
+  /* Each mapping covers half of the window at MAP_ADDR. */
+  CHECK ((fd = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap (MAP_ADDR, HALF, 1, fd, 0) == MAP_ADDR, "mmap first half");
+  CHECK (mmap (MAP_ADDR + HALF, HALF, 1, fd, 0) == MAP_ADDR + HALF,
+         "mmap second half");
+  for (i = 0; i < HUGE_PAGES; i++)
+    *marker (i) = i;
+  CHECK (contiguous (MAP_ADDR), "the mapped window is physically contiguous");
+  pa = get_phys_addr (MAP_ADDR + HALF);
+
+  munmap (MAP_ADDR);
+  msg ("munmap first half");
+  for (i = HUGE_PAGES / 2; i < HUGE_PAGES; i++)
+    if (*marker (i) != i)
+      fail ("mapped page %zu corrupted", i);
+  if (memcmp (MAP_ADDR + HALF, sample, strlen (sample)))
+    fail ("second half does not start with sample.txt");
+  CHECK (get_phys_addr (MAP_ADDR + HALF) == pa,
+         "second half kept its frames");
+  munmap (MAP_ADDR + HALF);
+}
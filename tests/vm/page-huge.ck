@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-huge) begin
+(page-huge) fill
+(page-huge) a 2 MB window of the array is physically contiguous
+(page-huge) verify in child
+(page-huge) wait for child
+(page-huge) verify in parent
+(page-huge) open "sample.txt"
+(page-huge) mmap first half
+(page-huge) mmap second half
+(page-huge) the mapped window is physically contiguous
+(page-huge) munmap first half
+(page-huge) second half kept its frames
+(page-huge) end
+EOF
+pass;
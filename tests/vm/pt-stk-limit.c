@@ -0,0 +1,27 @@
+/* Recurses with 4 kB frames until the stack passes the 64 kB
+   limit set on the kernel command line.  The process must be
+   terminated with -1 exit code once it runs into the guard page. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int
+recurse (int depth)
+{
+  volatile char frame[4096];
+
+  if (depth == 1024)
+    return 0;
+  memset ((char *) frame, depth, sizeof frame);
+  if (depth == 8)
+    msg ("32 kB deep");
+  return recurse (depth + 1) + frame[0];
+}
+
+void
+test_main (void)
+{
+  recurse (0);
+  fail ("stack grew past its limit");
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(pt-stk-limit) begin
+(pt-stk-limit) 32 kB deep
+pt-stk-limit: exit(-1)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Repeatedly scans an array larger than memory while reading a
+ * small hot set in between, with the 2Q eviction policy.
+ * For this test, Pintos memory size is 10MB.  Both the hot set and
+ * the scanned pages must survive being swapped out and back in. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define SCAN_SIZE (12 * ONE_MB)
+#define SCAN_PAGES (SCAN_SIZE / PAGE_SIZE)
+#define HOT_PAGES 16
+#define ROUNDS 3
+
+static char scan[SCAN_SIZE];
+static char hot[HOT_PAGES * PAGE_SIZE];
+
+/* Checks that every hot page holds ROUND. */
+static void
+check_hot (int round)
+{
+  size_t i;
+
+  for (i = 0; i < HOT_PAGES; i++)
+    if (hot[i * PAGE_SIZE] != (char) round)
+      fail ("hot page %zu is inconsistent", i);
+}
+
+void
+test_main (void)
+{
+  size_t i;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      for (i = 0; i < HOT_PAGES; i++)
+        hot[i * PAGE_SIZE] = (char) round;
+
+      for (i = 0; i < SCAN_PAGES; i++)
+        {
+          char *p = scan + i * PAGE_SIZE;
+          if (round > 0 && *p != (char) (i + round - 1))
+            fail ("scanned page %zu is inconsistent", i);
+          *p = (char) (i + round);
+          if (i % 64 == 0)
+            check_hot (round);
+        }
+      msg ("round %d done", round);
+    }
+  check_hot (ROUNDS - 1);
+}
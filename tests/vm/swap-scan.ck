@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-scan) begin
+(swap-scan) round 0 done
+(swap-scan) round 1 done
+(swap-scan) round 2 done
+(swap-scan) end
+EOF
+pass;
@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <limits.h>
 #include <random.h>
+#include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -21,6 +22,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -31,6 +33,7 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/evict.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -231,6 +234,22 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (value == NULL || !evict_select_policy (value))
+				PANIC ("unknown eviction policy `%s'", value ? value : "");
+		}
+		else if (!strcmp (name, "-stack")) {
+			if (value == NULL || atoi (value) <= 0)
+				PANIC ("bad stack size `%s'", value ? value : "");
+			vm_stack_limit = ROUND_UP ((size_t) atoi (value) * 1024, PGSIZE);
+		}
+		else if (!strcmp (name, "-faultaround")) {
+			if (value == NULL || atoi (value) < 0)
+				PANIC ("bad fault-around window `%s'", value ? value : "");
+			vm_fault_around = atoi (value);
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -339,6 +358,11 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict pages by POLICY: clock, wsclock or 2q.\n"
+			"  -stack=SIZE        Limit user stacks to SIZE kB (default 1024).\n"
+			"  -faultaround=N     Load file pages N at a time (default 16).\n"
 #endif
 			);
 	power_off ();
@@ -373,4 +397,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
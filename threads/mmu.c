@@ -8,12 +8,34 @@
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Replaces the 2 MB mapping in page directory entry PDE, which maps VA,
+ * by PT, a page table of 512 pages mapping the same memory with the same
+ * permissions, accessed and dirty bits, so that the pages can be changed
+ * one at a time. */
+static void
+split_huge_pde (uint64_t *pde, const uint64_t va, uint64_t *pt) {
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (PTE_ADDR (*pde) + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+
+	/* VA may belong to another address space, in which case this only
+	 * costs an unrelated TLB entry. */
+	invlpg (va & ~(HPGSIZE - 1));
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
-		if (!((uint64_t) pte & PTE_P)) {
+		if ((uint64_t) pte & PTE_PS) {
+			uint64_t *pt = palloc_get_page (0);
+			if (pt == NULL)
+				return NULL;
+			split_huge_pde (&pdp[idx], va, pt);
+		} else if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
 				if (new_page)
@@ -88,6 +110,44 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the page directory entry for VA in PML4, or a null pointer if
+ * the levels above it are missing and CREATE is false or memory
+ * allocation fails. */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *table = pml4;
+	const unsigned idx[] = { PML4 (va), PDPE (va) };
+
+	for (unsigned level = 0; level < sizeof idx / sizeof *idx; level++) {
+		uint64_t *entry = &table[idx[level]];
+		if (!(*entry & PTE_P)) {
+			uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+			if (new_page == NULL)
+				return NULL;
+			*entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (*entry));
+	}
+	return &table[PDX (va)];
+}
+
+/* Like pml4e_walk() without CREATE, but a 2 MB mapping is left alone and
+ * its page directory entry returned instead, with *HUGE set to true.
+ * For looking at, not changing, the mapping of a single page. */
+static uint64_t *
+pte_lookup (uint64_t *pml4, const uint64_t va, bool *huge) {
+	uint64_t *pde = pde_walk (pml4, va, false);
+
+	*huge = false;
+	if (pde == NULL || !(*pde & PTE_P))
+		return NULL;
+	if (*pde & PTE_PS) {
+		*huge = true;
+		return pde;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +182,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (pdp[i] & PTE_PS) {
+			/* A 2 MB page: FUNC sees the directory entry once for every
+			 * page it maps. */
+			for (unsigned j = 0; j < HPG_CNT; j++) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT) |
+									 ((uint64_t) j << PTXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			}
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -169,7 +240,7 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if ((((uint64_t) pte) & PTE_P) && !(pdp[i] & PTE_PS))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -214,8 +285,11 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	bool huge;
+	uint64_t *pte = pte_lookup (pml4, (uint64_t) uaddr, &huge);
 
+	if (pte && huge)
+		return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & (HPGSIZE - 1));
 	if (pte && (*pte & PTE_P))
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
 	return NULL;
@@ -243,23 +317,88 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory starting at UPAGE to the
+ * physically contiguous 2 MB at kernel virtual address KPAGE, using a
+ * single page directory entry.  Both must be 2 MB aligned.  A page table
+ * already covering UPAGE is freed, but not the pages it maps, which the
+ * caller must have dealt with.
+ * Returns true if successful, false if memory allocation failed. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (((uint64_t) upage & (HPGSIZE - 1)) == 0);
+	ASSERT (((uint64_t) kpage & (HPGSIZE - 1)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 1);
+
+	if (pde == NULL)
+		return false;
+	if ((*pde & PTE_P) && !(*pde & PTE_PS))
+		palloc_free_page (ptov (PTE_ADDR (*pde)));
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+
+	/* Stale entries may remain for any of the 512 pages. */
+	if (rcr3 () == vtop (pml4))
+		lcr3 (vtop (pml4));
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
-void
+ * UPAGE need not be mapped.  Returns false, changing nothing, if UPAGE
+ * lies in a 2 MB page that could not be split up for lack of memory. */
+bool
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
+	bool huge;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_lookup (pml4, (uint64_t) upage, &huge);
+	if (pte != NULL && huge) {
+		pte = pml4e_walk (pml4, (uint64_t) upage, false);
+		if (pte == NULL)
+			return false;
+	}
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
 		if (rcr3 () == vtop (pml4))
 			invlpg ((uint64_t) upage);
 	}
+	return true;
+}
+
+/* Removes the 2 MB page that user virtual page UPAGE lies in from PML4
+ * as a whole, without splitting it up.  The memory it mapped is left to
+ * the caller.  Returns false, changing nothing, if UPAGE is not mapped
+ * by a 2 MB page. */
+bool
+pml4_clear_huge_page (uint64_t *pml4, void *upage) {
+	bool huge;
+	uint64_t *pde = pte_lookup (pml4, (uint64_t) upage, &huge);
+
+	if (pde == NULL || !huge)
+		return false;
+	*pde = 0;
+	if (rcr3 () == vtop (pml4))
+		invlpg ((uint64_t) upage);
+	return true;
+}
+
+/* Splits the 2 MB page that user virtual page UPAGE lies in into 512
+ * pages, using PT, a free page, as their page table.  UPAGE must be
+ * mapped by a 2 MB page.  For when memory is too short for
+ * pml4_clear_page() to do it. */
+void
+pml4_split_huge_page (uint64_t *pml4, void *upage, void *pt) {
+	bool huge;
+	uint64_t *pde = pte_lookup (pml4, (uint64_t) upage, &huge);
+
+	ASSERT (pde != NULL && huge);
+	split_huge_pde (pde, (uint64_t) upage, pt);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -268,15 +407,22 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	bool huge;
+	uint64_t *pte = pte_lookup (pml4, (uint64_t) vpage, &huge);
 	return pte != NULL && (*pte & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4.  Setting the bit of a 2 MB page marks all of its pages dirty,
+ * which is harmless, but clearing it splits the page up.  If there is no
+ * memory for that, the bit stays set, which costs at most a needless
+ * write-back. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	bool huge;
+	uint64_t *pte = pte_lookup (pml4, (uint64_t) vpage, &huge);
+	if (pte != NULL && huge && !dirty)
+		pte = pml4e_walk (pml4, (uint64_t) vpage, false);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
@@ -294,15 +440,18 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
  * PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_accessed (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	bool huge;
+	uint64_t *pte = pte_lookup (pml4, (uint64_t) vpage, &huge);
 	return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  A 2 MB page is not split up for this: its single
+   accessed bit is shared by all of its pages. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	bool huge;
+	uint64_t *pte = pte_lookup (pml4, (uint64_t) vpage, &huge);
 	if (pte) {
 		if (accessed)
 			*pte |= PTE_A;
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,7 @@ struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -232,6 +234,11 @@ split:
 			}
 		}
 	}
+
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -261,16 +268,41 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
+	return palloc_get_aligned (flags, page_cnt, 1);
+}
+
+/* Like palloc_get_multiple(), but the physical address of the first page
+   is a multiple of ALIGN pages. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = BITMAP_ERROR;
 
+	ASSERT (align > 0);
 	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (align == 1)
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	else {
+		size_t map_cnt = bitmap_size (pool->used_map);
+		size_t base_no = pg_no (vtop (pool->base));
+
+		for (size_t idx = (align - base_no % align) % align;
+				idx + page_cnt <= map_cnt; idx += align)
+			if (bitmap_none (pool->used_map, idx, page_cnt)) {
+				bitmap_set_multiple (pool->used_map, idx, page_cnt, true);
+				page_idx = idx;
+				break;
+			}
+	}
 	lock_release (&pool->lock);
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
+	if (page_idx != BITMAP_ERROR) {
+		enum intr_level old_level = intr_disable ();
+		pool->free_cnt -= page_cnt;
+		intr_set_level (old_level);
 		pages = pool->base + PGSIZE * page_idx;
-	else
+	} else
 		pages = NULL;
 
 	if (pages) {
@@ -320,6 +352,12 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+	/* Pages may be freed with interrupts off, e.g. while scheduling, so
+	   FREE_CNT is guarded by disabling interrupts, not the pool lock. */
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +366,14 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER is set
+   in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return pool->free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -425,3 +425,64 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Initializes RW, a readers-writer lock.  Any number of readers may
+   hold it at once, or a single writer.  A waiting writer keeps new
+   readers out, so that a stream of readers cannot starve it. */
+void
+rw_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	cond_init (&rw->readers_ok);
+	cond_init (&rw->writer_ok);
+	rw->readers = 0;
+	rw->writer = false;
+	rw->waiting_writers = 0;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rw_acquire_read (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	while (rw->writer || rw->waiting_writers > 0)
+		cond_wait (&rw->readers_ok, &rw->lock);
+	rw->readers++;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, held for reading. */
+void
+rw_release_read (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no one else holds it. */
+void
+rw_acquire_write (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	rw->waiting_writers++;
+	while (rw->writer || rw->readers > 0)
+		cond_wait (&rw->writer_ok, &rw->lock);
+	rw->waiting_writers--;
+	rw->writer = true;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, held for writing. */
+void
+rw_release_write (struct rwlock *rw) {
+	lock_acquire (&rw->lock);
+	ASSERT (rw->writer);
+	rw->writer = false;
+	if (rw->waiting_writers > 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	else
+		cond_broadcast (&rw->readers_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -13,6 +14,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -288,6 +290,9 @@ int process_exec(void *f_name)
 
     /* We first kill the current context */
     process_cleanup();
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
     // Argument Passing ~
     char *parse[64];
@@ -742,11 +747,21 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads PAGE on its first fault from the segment AUX, a struct
+ * load_info, and drops the page's reference to it. */
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct load_info *info = aux;
+	void *kva = page->frame->kva;
+	size_t ofs = (uint8_t *) page->va - (uint8_t *) info->upage;
+	size_t left = info->read_bytes - ofs;
+	size_t read_bytes = left < PGSIZE ? left : PGSIZE;
+	bool success = file_read_at (info->file, kva, read_bytes, info->ofs + ofs)
+		== (off_t) read_bytes;
+
+	memset (kva + read_bytes, 0, PGSIZE - read_bytes);
+	load_info_unref (info);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -766,29 +781,45 @@ lazy_load_segment (struct page *page, void *aux) {
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
+	struct load_info *info = NULL;
+	bool success = true;
+
 	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
+	/* The file is reopened once for the segment, and its pages share
+	 * the reference.  This function holds one of its own meanwhile. */
+	if (read_bytes > 0) {
+		info = load_info_create (file, ofs, upage, read_bytes);
+		if (info == NULL)
+			return false;
+	}
+
+	while (success && (read_bytes > 0 || zero_bytes > 0)) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		if (page_read_bytes == 0) {
+			/* Nothing to read: leave it a plain anonymous page so that
+			 * reads share the zero frame until the first write. */
+			success = vm_alloc_page (VM_ANON, upage, writable);
+		} else if (!vm_alloc_page_with_initializer (VM_ANON, upage, writable,
+					lazy_load_segment, load_info_ref (info))) {
+			load_info_unref (info);
+			success = false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
 	}
-	return true;
+	load_info_unref (info);
+	return success;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -797,10 +828,11 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	if (vm_alloc_page (VM_ANON | VM_STACK, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 
 	return success;
 }
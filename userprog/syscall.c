@@ -1,14 +1,23 @@
 #include "userprog/syscall.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <uio.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -21,6 +30,16 @@ bool remove(const char *file);
 int open(const char *file);
 int add_file_to_fdt(struct file *f);
 int read(int fd, void *buffer, unsigned size);
+int readv(int fd, const struct iovec *iov, int iovcnt);
+int writev(int fd, const struct iovec *iov, int iovcnt);
+int pread(int fd, void *buffer, unsigned size, off_t offset);
+int pwrite(int fd, const void *buffer, unsigned size, off_t offset);
+static void check_user_range(const void *uaddr, size_t size);
+static void console_read(void *ubuf, size_t size);
+static void console_write(const void *ubuf, size_t size);
+static int file_read_user(struct file *file, void *buffer, unsigned size);
+static int file_write_user(struct file *file, const void *buffer,
+		unsigned size);
 struct file *find_file_by_fd(int fd);
 void close_file_by_fd(int fd);
 void close(int fd);
@@ -30,6 +49,11 @@ tid_t fork(const char *thread_name, struct intr_frame *f);
 int file_size(int fd);
 void seek(int fd, unsigned position);
 unsigned tell(int fd);
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap(void *addr);
+int msync(void *addr, size_t length);
+#endif
 
 /* System call.
  *
@@ -54,8 +78,6 @@ unsigned tell(int fd);
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-
-	lock_init(&filesys_lock);
 	}
 
 /* The main system call interface */
@@ -63,6 +85,10 @@ void
 syscall_handler (struct intr_frame *f UNUSED) {
 	// TODO: Your implementation goes here.
 	int syscall_number = f->R.rax;
+#ifdef VM
+	/* Page faults in the kernel check stack growth against this. */
+	thread_current()->user_rsp = f->rsp;
+#endif
 
 	switch (syscall_number)
 	{
@@ -121,6 +147,35 @@ syscall_handler (struct intr_frame *f UNUSED) {
 	case SYS_TELL:
 		f->R.rax = tell(f->R.rdi);
 		break;
+
+	case SYS_READV:
+		f->R.rax = readv(f->R.rdi, (const struct iovec *)f->R.rsi, f->R.rdx);
+		break;
+
+	case SYS_WRITEV:
+		f->R.rax = writev(f->R.rdi, (const struct iovec *)f->R.rsi, f->R.rdx);
+		break;
+
+	case SYS_PREAD:
+		f->R.rax = pread(f->R.rdi, (void *)f->R.rsi, f->R.rdx, f->R.r10);
+		break;
+
+	case SYS_PWRITE:
+		f->R.rax = pwrite(f->R.rdi, (const void *)f->R.rsi, f->R.rdx, f->R.r10);
+		break;
+#ifdef VM
+	case SYS_MMAP:
+		f->R.rax = (uint64_t) mmap((void *)f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+		break;
+
+	case SYS_MUNMAP:
+		munmap((void *)f->R.rdi);
+		break;
+
+	case SYS_MSYNC:
+		f->R.rax = msync((void *)f->R.rdi, f->R.rsi);
+		break;
+#endif
 	}
 }
 
@@ -139,13 +194,13 @@ void exit(int status)
 
 int write(int fd, const void *buffer, unsigned size)
 {
-	check_address(buffer);
+	check_user_range(buffer, size);
 	int write_result = 0;
 
 
 	if (fd == 1)
 	{
-		putbuf(buffer, size);
+		console_write(buffer, size);
 		write_result = size;
 	}
 	else
@@ -161,9 +216,7 @@ int write(int fd, const void *buffer, unsigned size)
 		{
 			return -1;
 		}
-		lock_acquire(&filesys_lock);
-		write_result = file_write(fileobj, buffer, size);
-		lock_release(&filesys_lock);
+		write_result = file_write_user(fileobj, buffer, size);
 	}
 
 	return write_result;
@@ -175,14 +228,260 @@ int write(int fd, const void *buffer, unsigned size)
 	// return size;
 }
 
+/* User memory.
+ *
+ * A system call checks that a user range lies in user space, as a
+ * whole, and then accesses it directly: a page that is not present is
+ * brought in by the page fault handler, which ends the process if the
+ * address is bad.  The kernel ignores read-only mappings, so a range
+ * the kernel writes to also has its pages checked for writing.
+ *
+ * File data is moved between the buffer cache and the user pages
+ * directly, but the file system holds inode and buffer cache locks
+ * meanwhile that the page fault handler may need to bring in a page of
+ * a file.  So the user pages are pinned first, at most PIN_PAGES at a
+ * time, and cannot fault while the file system touches them. */
+
+/* Most user pages pinned by one file system call. */
+#define PIN_PAGES 16
+
+/* Ends the process unless the SIZE bytes at UADDR lie in user space. */
+static void check_user_range(const void *uaddr, size_t size)
+{
+	uint64_t start = (uint64_t)uaddr;
+
+	if (uaddr == NULL || !is_user_vaddr(uaddr) || size > KERN_BASE - start)
+		exit(-1);
+}
+
+#ifdef VM
+static bool pin_page(void *upage, bool write)
+{
+	return vm_pin_user_page(upage, write);
+}
+
+static void unpin_page(void *upage)
+{
+	vm_unpin_user_page(upage);
+}
+
+static bool user_page_writable(void *upage)
+{
+	return vm_prepare_user_write(upage);
+}
+#else
+/* Without virtual memory every user page stays present, so pinning only
+ * checks that the page is there. */
+static bool pin_page(void *upage, bool write)
+{
+	uint64_t *pte = pml4e_walk(thread_current()->pml4, (uint64_t)upage, 0);
+
+	return pte != NULL && (*pte & PTE_P) != 0 && (!write || is_writable(pte));
+}
+
+static void unpin_page(void *upage UNUSED)
+{
+}
+
+static bool user_page_writable(void *upage)
+{
+	return pin_page(upage, true);
+}
+#endif
+
+/* Ends the process unless the kernel may write to the SIZE bytes at
+ * UADDR. */
+static void check_user_write(void *uaddr, size_t size)
+{
+	uint8_t *end = (uint8_t *)uaddr + size;
+
+	check_user_range(uaddr, size);
+	for (uint8_t *p = pg_round_down(uaddr); p < end; p += PGSIZE)
+		if (!user_page_writable(p))
+			exit(-1);
+}
+
+/* Copies SIZE bytes from user address USRC to DST. */
+static void copy_from_user(void *dst, const void *usrc, size_t size)
+{
+	check_user_range(usrc, size);
+	memcpy(dst, usrc, size);
+}
+
+/* Copies SIZE bytes from SRC to user address UDST. */
+static void copy_to_user(void *udst, const void *src, size_t size)
+{
+	check_user_write(udst, size);
+	memcpy(udst, src, size);
+}
+
+/* Unpins the user pages spanning the SIZE bytes at UADDR. */
+static void unpin_user(void *uaddr, size_t size)
+{
+	uint8_t *end = (uint8_t *)uaddr + size;
+
+	for (uint8_t *p = pg_round_down(uaddr); p < end; p += PGSIZE)
+		unpin_page(p);
+}
+
+/* Pins the user pages spanning the SIZE bytes at UADDR, which the
+ * kernel writes to if WRITE.  Ends the process if one is bad. */
+static void pin_user(void *uaddr, size_t size, bool write)
+{
+	uint8_t *start = pg_round_down(uaddr);
+	uint8_t *end = (uint8_t *)uaddr + size;
+
+	check_user_range(uaddr, size);
+	for (uint8_t *p = start; p < end; p += PGSIZE)
+		if (!pin_page(p, write))
+		{
+			/* A pinned page would keep the process from exiting. */
+			unpin_user(start, p - start);
+			exit(-1);
+		}
+}
+
+/* Returns how many of the LEFT bytes at user address UBUF fit the
+ * PIN_PAGES pages from UBUF's page on. */
+static size_t pin_chunk(const void *ubuf, size_t left)
+{
+	size_t room = PIN_PAGES * PGSIZE - pg_ofs(ubuf);
+	return left < room ? left : room;
+}
+
+/* Reads from FILE into the SIZE bytes of user buffers IOV, in order.
+ * Reads at offset OFS, or at the file's position, which it advances, if
+ * OFS is negative.  Returns the number of bytes read. */
+static int file_readv_user(struct file *file, const struct iovec *iov,
+		size_t size, off_t ofs)
+{
+	int total = 0;
+
+	for (int i = 0; size > 0; i++)
+	{
+		uint8_t *ubuf = iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+
+		while (left > 0)
+		{
+			size_t chunk = pin_chunk(ubuf, left);
+			off_t n;
+
+			pin_user(ubuf, chunk, true);
+			n = ofs < 0 ? file_read(file, ubuf, chunk)
+				: file_read_at(file, ubuf, chunk, ofs + total);
+			unpin_user(ubuf, chunk);
+			total += n;
+			if (n < (off_t)chunk)
+				return total;
+			ubuf += n;
+			left -= n;
+			size -= n;
+		}
+	}
+	return total;
+}
+
+/* Writes the SIZE bytes of user buffers IOV to FILE, in order, at
+ * offset OFS, or at the file's position, which it advances, if OFS is
+ * negative.  Returns the number of bytes written. */
+static int file_writev_user(struct file *file, const struct iovec *iov,
+		size_t size, off_t ofs)
+{
+	int total = 0;
+
+	for (int i = 0; size > 0; i++)
+	{
+		uint8_t *ubuf = iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+
+		while (left > 0)
+		{
+			size_t chunk = pin_chunk(ubuf, left);
+			off_t n;
+
+			pin_user(ubuf, chunk, false);
+			n = ofs < 0 ? file_write(file, ubuf, chunk)
+				: file_write_at(file, ubuf, chunk, ofs + total);
+			unpin_user(ubuf, chunk);
+			total += n;
+			if (n < (off_t)chunk)
+				return total;
+			ubuf += n;
+			left -= n;
+			size -= n;
+		}
+	}
+	return total;
+}
+
+/* Reads SIZE bytes from FILE into user BUFFER.  Returns the number of
+ * bytes read. */
+static int file_read_user(struct file *file, void *buffer, unsigned size)
+{
+	struct iovec iov = { buffer, size };
+	return file_readv_user(file, &iov, size, -1);
+}
+
+/* Writes SIZE bytes from user BUFFER to FILE.  Returns the number of
+ * bytes written. */
+static int file_write_user(struct file *file, const void *buffer,
+		unsigned size)
+{
+	struct iovec iov = { (void *)buffer, size };
+	return file_writev_user(file, &iov, size, -1);
+}
+
+/* Reads SIZE bytes from the keyboard into user buffer UBUF. */
+static void console_read(void *ubuf, size_t size)
+{
+	uint8_t buf[128];
+
+	while (size > 0)
+	{
+		size_t n = size < sizeof buf ? size : sizeof buf;
+
+		for (size_t i = 0; i < n; i++)
+			buf[i] = input_getc();
+		copy_to_user(ubuf, buf, n);
+		ubuf = (uint8_t *)ubuf + n;
+		size -= n;
+	}
+}
+
+/* Writes the SIZE bytes at user address UBUF to the console.  putbuf()
+ * holds the console lock, so the pages are pinned first: a fault there
+ * would end the process with the lock held. */
+static void console_write(const void *ubuf, size_t size)
+{
+	uint8_t *p = (uint8_t *)ubuf;
+
+	while (size > 0)
+	{
+		size_t chunk = pin_chunk(p, size);
+
+		pin_user(p, chunk, false);
+		putbuf((const char *)p, chunk);
+		unpin_user(p, chunk);
+		p += chunk;
+		size -= chunk;
+	}
+}
+
 void check_address(void *addr)
 {
 	if (addr == NULL)
 		exit(-1);
 	if (!is_user_vaddr(addr))
 		exit(-1);
+#ifdef VM
+	/* Pages are loaded lazily, so a page need not be mapped yet. */
+	if (spt_find_page(&thread_current()->spt, addr) == NULL)
+		exit(-1);
+#else
 	if (pml4_get_page(thread_current()->pml4, addr) == NULL)
 		exit(-1);
+#endif
 }
 
 bool create(const char *file, unsigned initial_size)
@@ -256,44 +555,131 @@ void close_file_by_fd(int fd)
 
 int read(int fd, void *buffer, unsigned size)
 {
-	check_address(buffer);
-	char *ptr = (char *)buffer;
+	check_user_range(buffer, size);
 	int read_result = 0;
 
-	lock_acquire(&filesys_lock);
-
 	if (fd == 0)
 	{
-		for (int i = 0; i < size; i++)
-		{
-			*ptr++ = input_getc();
-			read_result++;
-		}
-		lock_release(&filesys_lock);
+		console_read(buffer, size);
+		read_result = size;
 	}
 	// fd != 0 인 경우
 	else
 	{
 		if (fd < 2)
 		{
-			lock_release(&filesys_lock);
 			return -1;
 		}
 
 		struct file *fileobj = find_file_by_fd(fd);
 		if (fileobj == NULL)
 		{
-			lock_release(&filesys_lock);
 			return -1;
 		}
 
-		read_result = file_read(fileobj, buffer, size);
-		lock_release(&filesys_lock);
+		read_result = file_read_user(fileobj, buffer, size);
 	}
 
 	return read_result;
 }
 
+/* Copies the IOVCNT user buffers at IOV into KIOV, which has room for
+ * IOV_MAX, and checks each.  Stores their total size in *SIZE.  Returns
+ * false if IOVCNT is out of range or the total does not fit an int. */
+static bool copy_iov(struct iovec *kiov, const struct iovec *iov,
+		int iovcnt, size_t *size)
+{
+	if (iovcnt <= 0 || iovcnt > IOV_MAX)
+		return false;
+	copy_from_user(kiov, iov, iovcnt * sizeof *kiov);
+
+	*size = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		if (kiov[i].iov_len == 0)
+			continue;
+		check_user_range(kiov[i].iov_base, kiov[i].iov_len);
+		if (kiov[i].iov_len > INT_MAX - *size)
+			return false;
+		*size += kiov[i].iov_len;
+	}
+	return true;
+}
+
+int readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct iovec kiov[IOV_MAX];
+	struct file *fileobj = NULL;
+	size_t size;
+	int read_result;
+
+	if (fd != 0 && (fileobj = find_file_by_fd(fd)) == NULL)
+		return -1;
+	if (!copy_iov(kiov, iov, iovcnt, &size))
+		return -1;
+
+	if (fd == 0)
+	{
+		for (int i = 0; i < iovcnt; i++)
+			console_read(kiov[i].iov_base, kiov[i].iov_len);
+		read_result = size;
+	}
+	else
+		read_result = file_readv_user(fileobj, kiov, size, -1);
+	return read_result;
+}
+
+int writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct iovec kiov[IOV_MAX];
+	struct file *fileobj = NULL;
+	size_t size;
+	int write_result;
+
+	if (fd != 1 && (fileobj = find_file_by_fd(fd)) == NULL)
+		return -1;
+	if (!copy_iov(kiov, iov, iovcnt, &size))
+		return -1;
+
+	if (fd == 1)
+	{
+		for (int i = 0; i < iovcnt; i++)
+			console_write(kiov[i].iov_base, kiov[i].iov_len);
+		write_result = size;
+	}
+	else
+		write_result = file_writev_user(fileobj, kiov, size, -1);
+	return write_result;
+}
+
+/* Like read(), but reads at OFFSET and leaves the file position
+ * alone.  Not for the console. */
+int pread(int fd, void *buffer, unsigned size, off_t offset)
+{
+	struct file *fileobj = find_file_by_fd(fd);
+	struct iovec iov = { buffer, size };
+
+	if (fileobj == NULL || offset < 0)
+		return -1;
+	if (size == 0)
+		return 0;
+	return file_readv_user(fileobj, &iov, size, offset);
+}
+
+/* Like write(), but writes at OFFSET and leaves the file position
+ * alone.  Not for the console. */
+int pwrite(int fd, const void *buffer, unsigned size, off_t offset)
+{
+	struct file *fileobj = find_file_by_fd(fd);
+	struct iovec iov = { (void *)buffer, size };
+
+	if (fileobj == NULL || offset < 0)
+		return -1;
+	if (size == 0)
+		return 0;
+	return file_writev_user(fileobj, &iov, size, offset);
+}
+
 int wait(int pid)
 {
 	return process_wait(pid);
@@ -352,4 +738,24 @@ unsigned tell(int fd)
 	if (file == NULL)
 		return;
 	return file_tell(file);
-}
\ No newline at end of file
+}
+
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+	struct file *file = find_file_by_fd(fd);
+	if (file == NULL)
+		return NULL;
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+void munmap(void *addr)
+{
+	do_munmap(addr);
+}
+
+int msync(void *addr, size_t length)
+{
+	return do_msync(addr, length);
+}
+#endif
@@ -1,7 +1,42 @@
-/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
+/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page).
+ *
+ * Swapped out pages first go to zswap, a cache of LZ-compressed pages in
+ * memory from the kernel pool, which costs no disk I/O to write or read
+ * back.  A page that does not compress to at most half its size goes
+ * straight to the swap disk, and when zswap is full its oldest pages are
+ * moved to the disk to make room. */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* zswap may use up to 1/ZSWAP_POOL_DIV of the kernel pool. */
+#define ZSWAP_POOL_DIV 8
+
+/* Pages that compress to more than this many bytes go to the disk. */
+#define ZSWAP_MAX_LEN (PGSIZE / 2)
+
+/* Compressor.  A compressed page is a sequence of tokens, each starting
+ * with a control byte C:
+ *   C < 0x80   C + 1 literal bytes follow.
+ *   C >= 0x80  Copy (C & 0x7f) + LZ_MIN_MATCH bytes from the given
+ *              distance back in the output; a two byte little-endian
+ *              distance follows. */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_BITS 10
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -9,6 +44,37 @@ static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
 
+/* Free (false) and used (true) swap slots, protected by SWAP_LOCK. */
+static struct bitmap *swap_slots;
+static struct lock swap_lock;
+
+/* A page in zswap. */
+struct zswap_entry {
+	struct list_elem elem;      /* In ZSWAP_LRU. */
+	struct anon_page *anon;     /* The page stored here. */
+	size_t len;                 /* Length of DATA. */
+	uint8_t data[];             /* Compressed contents. */
+};
+
+/* zswap, protected by ZSWAP_LOCK.  Entries are on ZSWAP_LRU oldest
+ * first.  The lock is held while moving an entry to the disk, so that
+ * the page being moved is never in neither place. */
+static struct lock zswap_lock;
+static struct list zswap_lru;
+static size_t zswap_bytes;      /* Bytes of compressed data stored. */
+static size_t zswap_budget;     /* Limit on ZSWAP_BYTES. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static uint8_t *zswap_buf;      /* Compressor output. */
+static void *zswap_bounce;      /* Page to decompress into for the disk. */
+
+/* Statistics. */
+static long long zswap_stored;  /* # of pages compressed into zswap. */
+static long long zswap_in_bytes;    /* Their total compressed size. */
+static long long zswap_rejected;    /* # of pages that did not compress. */
+static long long zswap_hits;    /* # of swap-ins served from zswap. */
+static long long disk_reads;    /* # of pages read from the swap disk. */
+static long long disk_writes;   /* # of pages written to the swap disk. */
+
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
 	.swap_in = anon_swap_in,
@@ -20,8 +86,18 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_slots = bitmap_create (swap_disk != NULL
+			? disk_size (swap_disk) / SECTORS_PER_SLOT : 0);
+	if (swap_slots == NULL)
+		PANIC ("out of memory for swap table");
+	lock_init (&swap_lock);
+
+	lock_init (&zswap_lock);
+	list_init (&zswap_lru);
+	zswap_budget = palloc_free_cnt (0) / ZSWAP_POOL_DIV * PGSIZE;
+	zswap_buf = palloc_get_page (PAL_ASSERT);
+	zswap_bounce = palloc_get_page (PAL_ASSERT);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +107,251 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->swap_slot = SIZE_MAX;
+	anon_page->zentry = NULL;
+	return true;
+}
+
+static uint32_t
+load32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Appends the literals SRC[START, END) to the output at DST + *OUT.
+ * Returns false if that would take the output past MAX bytes. */
+static bool
+lz_literals (const uint8_t *src, size_t start, size_t end, uint8_t *dst,
+		size_t *out, size_t max) {
+	while (start < end) {
+		size_t n = end - start < LZ_MAX_LITERALS
+			? end - start : LZ_MAX_LITERALS;
+		if (*out + 1 + n > max)
+			return false;
+		dst[(*out)++] = n - 1;
+		memcpy (dst + *out, src + start, n);
+		*out += n;
+		start += n;
+	}
+	return true;
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed length,
+ * or 0 if it would be longer than MAX bytes.  Uses LZ_TABLE. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t max) {
+	size_t ip = 0, lit = 0, out = 0;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (ip + LZ_MIN_MATCH <= PGSIZE) {
+		uint32_t seq = load32 (src + ip);
+		uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t cand = lz_table[h];
+		size_t len;
+
+		/* Entries hold a position plus one, so that 0 is empty. */
+		lz_table[h] = ip + 1;
+		if (cand == 0 || ip - --cand > 0xffff || load32 (src + cand) != seq) {
+			ip++;
+			continue;
+		}
+		for (len = LZ_MIN_MATCH; ip + len < PGSIZE && len < LZ_MAX_MATCH
+				&& src[cand + len] == src[ip + len]; len++)
+			continue;
+
+		if (!lz_literals (src, lit, ip, dst, &out, max) || out + 3 > max)
+			return 0;
+		dst[out++] = 0x80 | (len - LZ_MIN_MATCH);
+		dst[out++] = (ip - cand) & 0xff;
+		dst[out++] = (ip - cand) >> 8;
+		ip += len;
+		lit = ip;
+	}
+	if (!lz_literals (src, lit, PGSIZE, dst, &out, max))
+		return 0;
+	return out;
+}
+
+/* Decompresses the LEN bytes at SRC into the page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst) {
+	size_t ip = 0, op = 0;
+
+	while (ip < len) {
+		uint8_t c = src[ip++];
+		if (c < 0x80) {
+			memcpy (dst + op, src + ip, c + 1);
+			ip += c + 1;
+			op += c + 1;
+		} else {
+			size_t n = (c & 0x7f) + LZ_MIN_MATCH;
+			size_t dist = src[ip] | (src[ip + 1] << 8);
+
+			ip += 2;
+			ASSERT (dist > 0 && dist <= op);
+			/* Byte by byte: the copy may overlap its own output. */
+			for (; n > 0; n--, op++)
+				dst[op] = dst[op - dist];
+		}
+	}
+	ASSERT (op == PGSIZE);
+}
+
+/* Writes the page at KVA to a free swap slot and records the slot in
+ * ANON.  Returns false if the swap disk is full. */
+static bool
+disk_store (struct anon_page *anon, const void *kva) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_slots, 0, 1, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_write (swap_disk, slot * SECTORS_PER_SLOT + i,
+				kva + i * DISK_SECTOR_SIZE);
+	anon->swap_slot = slot;
+	disk_writes++;
+	return true;
+}
+
+static void
+zswap_remove (struct zswap_entry *e) {
+	list_remove (&e->elem);
+	zswap_bytes -= e->len;
+	e->anon->zentry = NULL;
+	free (e);
+}
+
+/* Moves the oldest page in zswap to the swap disk.  Returns false if
+ * zswap is empty or the disk is full. */
+static bool
+zswap_writeback (void) {
+	struct zswap_entry *e;
+
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+	if (list_empty (&zswap_lru))
+		return false;
+	e = list_entry (list_front (&zswap_lru), struct zswap_entry, elem);
+	lz_decompress (e->data, e->len, zswap_bounce);
+	if (!disk_store (e->anon, zswap_bounce))
+		return false;
+	zswap_remove (e);
+	return true;
+}
+
+/* Tries to store the page at KVA in zswap for ANON.  Returns false if
+ * it does not compress well or there is no room. */
+static bool
+zswap_store (struct anon_page *anon, const void *kva) {
+	struct zswap_entry *e;
+	size_t len;
+
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+	len = lz_compress (kva, zswap_buf, ZSWAP_MAX_LEN);
+	if (len == 0) {
+		zswap_rejected++;
+		return false;
+	}
+	while (zswap_bytes + len > zswap_budget)
+		if (!zswap_writeback ())
+			return false;
+
+	e = malloc (sizeof *e + len);
+	if (e == NULL)
+		return false;
+	e->anon = anon;
+	e->len = len;
+	memcpy (e->data, zswap_buf, len);
+	list_push_back (&zswap_lru, &e->elem);
+	zswap_bytes += len;
+	anon->zentry = e;
+
+	zswap_stored++;
+	zswap_in_bytes += len;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot;
+
+	lock_acquire (&zswap_lock);
+	if (anon_page->zentry != NULL) {
+		lz_decompress (anon_page->zentry->data, anon_page->zentry->len, kva);
+		zswap_remove (anon_page->zentry);
+		zswap_hits++;
+		lock_release (&zswap_lock);
+		return true;
+	}
+	lock_release (&zswap_lock);
+
+	/* A page on the disk stays there until it is swapped in. */
+	slot = anon_page->swap_slot;
+	if (slot == SIZE_MAX)
+		return false;
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, slot * SECTORS_PER_SLOT + i,
+				kva + i * DISK_SECTOR_SIZE);
+	disk_reads++;
+
+	lock_acquire (&swap_lock);
+	bitmap_reset (swap_slots, slot);
+	lock_release (&swap_lock);
+	anon_page->swap_slot = SIZE_MAX;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	void *kva = page->frame->kva;
+	bool stored;
+
+	lock_acquire (&zswap_lock);
+	stored = zswap_store (anon_page, kva);
+	lock_release (&zswap_lock);
+	return stored || disk_store (anon_page, kva);
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	/* Frees the frame first: an eviction in progress may still be
+	 * assigning a slot. */
+	vm_free_frame (page);
+
+	lock_acquire (&zswap_lock);
+	if (anon_page->zentry != NULL)
+		zswap_remove (anon_page->zentry);
+	lock_release (&zswap_lock);
+
+	if (anon_page->swap_slot != SIZE_MAX) {
+		lock_acquire (&swap_lock);
+		bitmap_reset (swap_slots, anon_page->swap_slot);
+		lock_release (&swap_lock);
+	}
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	long long swap_ins = zswap_hits + disk_reads;
+
+	printf ("Swap: %lld pages compressed to %lld%% in zswap, "
+			"%lld incompressible, %lld pages written to disk\n",
+			zswap_stored,
+			zswap_stored ? zswap_in_bytes * 100 / (zswap_stored * PGSIZE) : 0,
+			zswap_rejected, disk_writes);
+	printf ("Swap: %lld of %lld swap-ins hit zswap\n", zswap_hits, swap_ins);
 }
@@ -0,0 +1,348 @@
+/* evict.c: Page replacement policies.
+ *
+ * Three policies are provided and one is chosen at boot with the
+ * "-evict=POLICY" kernel option:
+ *
+ *   clock    Second chance over a ring of all resident frames.
+ *   wsclock  Clock that only evicts frames which fell out of their
+ *            process's working set, i.e. were not used for WS_TAU ticks.
+ *   2q       Simplified 2Q: first-touch frames sit in a FIFO (A1in) and
+ *            only pages that fault again soon after eviction, as recorded
+ *            in the ghost list A1out, are promoted to the LRU queue (Am).
+ *            Scans of large arrays then cannot flush the hot set. */
+
+#include "vm/evict.h"
+#include <list.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* WSClock: frames unused for this many timer ticks have left the working
+ * set of their process. */
+#define WS_TAU (TIMER_FREQ / 4)
+
+/* 2Q: number of recently evicted pages remembered in A1out. */
+#define A1OUT_SIZE 256
+
+/* Queue a frame is on, kept in frame->queue. */
+enum {
+	Q_NONE,
+	Q_A1IN,                     /* 2Q first-touch FIFO. */
+	Q_RING                      /* Clock ring, or 2Q's Am. */
+};
+
+/* Resident frames.  Clock and WSClock keep every frame on RING; 2Q keeps
+ * hot frames on RING (most recently used first) and new ones on A1IN. */
+static struct list ring;
+static struct list a1in;
+static size_t a1in_cnt;
+static size_t frame_cnt;
+
+/* Clock hand: the next frame on RING to look at, or NULL for the start. */
+static struct list_elem *hand;
+
+/* 2Q ghost list of recently evicted pages, as page keys. */
+static uint64_t a1out[A1OUT_SIZE];
+static size_t a1out_next;
+
+static const struct evict_policy clock_policy;
+static const struct evict_policy wsclock_policy;
+static const struct evict_policy twoq_policy;
+
+static const struct evict_policy *const policies[] = {
+	&clock_policy, &wsclock_policy, &twoq_policy,
+};
+
+/* Policy in use.  Clock unless overridden on the command line. */
+const struct evict_policy *evict_policy = &clock_policy;
+
+/* Selects the policy called NAME.  Returns false if there is none. */
+bool
+evict_select_policy (const char *name) {
+	for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (policies[i]->name, name)) {
+			evict_policy = policies[i];
+			return true;
+		}
+	return false;
+}
+
+void
+evict_init (void) {
+	list_init (&ring);
+	list_init (&a1in);
+}
+
+/* Calls FUNC on every frame known to the policy, coldest queue first. */
+void
+evict_for_each_frame (evict_frame_func *func, void *aux) {
+	struct list *queues[] = { &a1in, &ring };
+	struct list_elem *e;
+
+	for (size_t i = 0; i < sizeof queues / sizeof *queues; i++)
+		for (e = list_begin (queues[i]); e != list_end (queues[i]);
+				e = list_next (e))
+			if (!func (list_entry (e, struct frame, elem), aux))
+				return;
+}
+
+/* Returns true if FRAME's page was accessed since the last check, either
+ * according to the hardware or to the sampler, and clears both. */
+static bool
+test_and_clear_accessed (struct frame *frame) {
+	struct page *page = frame->page;
+	uint64_t *pml4 = page->owner->pml4;
+	bool accessed = frame->referenced || pml4_is_accessed (pml4, page->va);
+
+	frame->referenced = false;
+	if (accessed)
+		pml4_set_accessed (pml4, page->va, false);
+	return accessed;
+}
+
+/* Returns the frame under the clock hand and advances the hand, wrapping
+ * around at the end of RING.  RING must not be empty. */
+static struct frame *
+hand_advance (void) {
+	struct frame *frame;
+
+	if (hand == NULL || hand == list_end (&ring))
+		hand = list_begin (&ring);
+	frame = list_entry (hand, struct frame, elem);
+	hand = list_next (hand);
+	return frame;
+}
+
+/* Adds FRAME to RING just behind the hand, so that it is looked at last. */
+static void
+ring_insert (struct frame *frame) {
+	if (hand == NULL || hand == list_end (&ring))
+		list_push_back (&ring, &frame->elem);
+	else
+		list_insert (hand, &frame->elem);
+	frame->queue = Q_RING;
+	frame_cnt++;
+}
+
+static void
+ring_remove (struct frame *frame) {
+	if (hand == &frame->elem)
+		hand = list_next (hand);
+	list_remove (&frame->elem);
+	frame->queue = Q_NONE;
+	frame_cnt--;
+}
+
+/* Clock. */
+
+static void
+clock_fault (struct frame *frame) {
+	frame->referenced = true;
+	ring_insert (frame);
+}
+
+static void
+clock_sample (struct frame *frame, bool accessed) {
+	if (accessed)
+		frame->referenced = true;
+}
+
+static struct frame *
+clock_reclaim (void) {
+	/* Two sweeps clear every reference bit, so a third finds a victim
+	 * unless all frames are pinned. */
+	for (size_t i = 0; i < 2 * frame_cnt + 1 && !list_empty (&ring); i++) {
+		struct frame *frame = hand_advance ();
+		if (frame->pin_cnt > 0 || test_and_clear_accessed (frame))
+			continue;
+		ring_remove (frame);
+		return frame;
+	}
+	return NULL;
+}
+
+static const struct evict_policy clock_policy = {
+	.name = "clock",
+	.fault = clock_fault,
+	.remove = ring_remove,
+	.sample = clock_sample,
+	.reclaim = clock_reclaim,
+};
+
+/* WSClock. */
+
+static void
+wsclock_fault (struct frame *frame) {
+	frame->last_used = timer_ticks ();
+	ring_insert (frame);
+}
+
+static void
+wsclock_sample (struct frame *frame, bool accessed) {
+	if (accessed)
+		frame->last_used = timer_ticks ();
+}
+
+static struct frame *
+wsclock_reclaim (void) {
+	int64_t now = timer_ticks ();
+	struct frame *victim = NULL;
+	struct frame *oldest = NULL;
+
+	/* One sweep: take the first frame outside the working set, preferring
+	 * one that is clean and so needs no write. */
+	for (size_t i = 0; i < frame_cnt; i++) {
+		struct frame *frame = hand_advance ();
+		struct page *page = frame->page;
+
+		if (frame->pin_cnt > 0)
+			continue;
+		if (test_and_clear_accessed (frame)) {
+			frame->last_used = now;
+			continue;
+		}
+		if (now - frame->last_used > WS_TAU) {
+			if (page_get_type (page) == VM_FILE
+					&& !pml4_is_dirty (page->owner->pml4, page->va)) {
+				victim = frame;
+				break;
+			}
+			if (victim == NULL)
+				victim = frame;
+		}
+		if (oldest == NULL || frame->last_used < oldest->last_used)
+			oldest = frame;
+	}
+
+	/* Everything is in some working set: fall back to the least recently
+	 * used frame. */
+	if (victim == NULL)
+		victim = oldest;
+	if (victim != NULL)
+		ring_remove (victim);
+	return victim;
+}
+
+static const struct evict_policy wsclock_policy = {
+	.name = "wsclock",
+	.fault = wsclock_fault,
+	.remove = ring_remove,
+	.sample = wsclock_sample,
+	.reclaim = wsclock_reclaim,
+};
+
+/* 2Q. */
+
+/* Identifies the page in FRAME across evictions. */
+static uint64_t
+page_key (const struct frame *frame) {
+	const struct page *page = frame->page;
+	return ((uint64_t) page->owner->tid << 40) | pg_no (page->va);
+}
+
+static bool
+a1out_contains (uint64_t key) {
+	for (size_t i = 0; i < A1OUT_SIZE; i++)
+		if (a1out[i] == key)
+			return true;
+	return false;
+}
+
+static void
+twoq_fault (struct frame *frame) {
+	if (a1out_contains (page_key (frame))) {
+		/* Reused soon after eviction: the page is hot. */
+		list_push_front (&ring, &frame->elem);
+		frame->queue = Q_RING;
+	} else {
+		list_push_back (&a1in, &frame->elem);
+		frame->queue = Q_A1IN;
+		a1in_cnt++;
+	}
+	frame_cnt++;
+}
+
+static void
+twoq_remove (struct frame *frame) {
+	if (frame->queue == Q_A1IN)
+		a1in_cnt--;
+	list_remove (&frame->elem);
+	frame->queue = Q_NONE;
+	frame_cnt--;
+}
+
+static void
+twoq_sample (struct frame *frame, bool accessed) {
+	/* Keep Am in LRU order.  References while on A1in are correlated
+	 * with the first touch and deliberately ignored. */
+	if (accessed && frame->queue == Q_RING) {
+		list_remove (&frame->elem);
+		list_push_front (&ring, &frame->elem);
+	}
+}
+
+/* Returns the oldest unpinned frame on A1in, or NULL. */
+static struct frame *
+twoq_reclaim_a1in (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&a1in); e != list_end (&a1in); e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		if (frame->pin_cnt == 0) {
+			a1out[a1out_next++ % A1OUT_SIZE] = page_key (frame);
+			return frame;
+		}
+	}
+	return NULL;
+}
+
+/* Returns the least recently used unpinned frame on Am, or NULL.
+ * Frames found accessed get another round at the front. */
+static struct frame *
+twoq_reclaim_am (void) {
+	size_t n = frame_cnt - a1in_cnt;
+	struct frame *fallback = NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		struct frame *frame = list_entry (list_back (&ring), struct frame,
+				elem);
+		list_remove (&frame->elem);
+		list_push_front (&ring, &frame->elem);
+		if (frame->pin_cnt > 0)
+			continue;
+		if (!test_and_clear_accessed (frame))
+			return frame;
+		if (fallback == NULL)
+			fallback = frame;
+	}
+	return fallback;
+}
+
+static struct frame *
+twoq_reclaim (void) {
+	/* A1in is allowed a quarter of memory. */
+	size_t kin = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+	struct frame *victim = NULL;
+
+	if (a1in_cnt > kin || list_empty (&ring))
+		victim = twoq_reclaim_a1in ();
+	if (victim == NULL && !list_empty (&ring))
+		victim = twoq_reclaim_am ();
+	if (victim == NULL)
+		victim = twoq_reclaim_a1in ();
+	if (victim != NULL)
+		twoq_remove (victim);
+	return victim;
+}
+
+static const struct evict_policy twoq_policy = {
+	.name = "2q",
+	.fault = twoq_fault,
+	.remove = twoq_remove,
+	.sample = twoq_sample,
+	.reclaim = twoq_reclaim,
+};
@@ -0,0 +1,90 @@
+/* faultstat.c: Page fault counters and latency histograms.
+ *
+ * Every fault handled by vm_try_handle_fault() is counted by how it was
+ * resolved, and its latency in TSC cycles goes into a histogram with one
+ * bucket per power of two.  The counters are printed at shutdown; user
+ * programs and debuggers can dump the histograms as well with "int
+ * $0x45", which also returns the total number of faults in RAX.
+ *
+ * The counters are not locked.  An update lost to a race only makes the
+ * numbers slightly off. */
+
+#include "vm/faultstat.h"
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "intrinsic.h"
+
+/* Latency buckets: bucket K counts faults of 2^K to 2^(K+1) - 1 cycles. */
+#define HIST_BUCKETS 40
+
+static const char *const kind_names[FAULT_KIND_CNT] = {
+	[FAULT_MINOR] = "minor",
+	[FAULT_ANON] = "anon",
+	[FAULT_UNINIT] = "uninit",
+	[FAULT_SWAP_IN] = "swap-in",
+	[FAULT_FILE] = "file",
+	[FAULT_COW] = "cow",
+	[FAULT_STACK] = "stack",
+	[FAULT_INVALID] = "invalid",
+};
+
+static long long counts[FAULT_KIND_CNT];
+static uint64_t cycles[FAULT_KIND_CNT];
+static long long hist[FAULT_KIND_CNT][HIST_BUCKETS];
+
+static void dump_intr (struct intr_frame *f);
+
+void
+faultstat_init (void) {
+	intr_register_int (0x45, 3, INTR_ON, dump_intr, "Dump VM Fault Statistics");
+}
+
+/* Counts a fault of KIND whose handling started at START_TSC. */
+void
+faultstat_record (enum fault_kind kind, uint64_t start_tsc) {
+	uint64_t delta = rdtsc () - start_tsc;
+	int bucket = 0;
+
+	while (bucket < HIST_BUCKETS - 1 && (delta >> (bucket + 1)) != 0)
+		bucket++;
+	counts[kind]++;
+	cycles[kind] += delta;
+	hist[kind][bucket]++;
+}
+
+/* Prints the number of faults and their average latency for each kind of
+ * fault that occurred, and if HISTOGRAMS, the non-empty buckets of its
+ * latency histogram. */
+void
+faultstat_print (bool histograms) {
+	printf ("Page faults:");
+	for (int k = 0; k < FAULT_KIND_CNT; k++)
+		if (counts[k] > 0)
+			printf (" %lld %s (%llu cycles avg)", counts[k], kind_names[k],
+					cycles[k] / counts[k]);
+	printf ("\n");
+
+	if (!histograms)
+		return;
+	for (int k = 0; k < FAULT_KIND_CNT; k++) {
+		if (counts[k] == 0)
+			continue;
+		printf ("  %s:", kind_names[k]);
+		for (int b = 0; b < HIST_BUCKETS; b++)
+			if (hist[k][b] > 0)
+				printf (" 2^%d:%lld", b, hist[k][b]);
+		printf ("\n");
+	}
+}
+
+/* Interrupt 0x45: prints all statistics and returns the total number of
+ * faults in RAX. */
+static void
+dump_intr (struct intr_frame *f) {
+	long long total = 0;
+
+	for (int k = 0; k < FAULT_KIND_CNT; k++)
+		total += counts[k];
+	faultstat_print (true);
+	f->R.rax = total;
+}
@@ -1,6 +1,13 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include <uio.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,45 +21,396 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Protects the reference counts of load_infos, which the pages of
+ * forked processes share. */
+static struct lock load_info_lock;
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	lock_init (&load_info_lock);
 }
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
+	/* Filled in by file_lazy_load(). */
+	struct file_page *file_page = &page->file;
+	file_page->file = NULL;
+	return true;
+}
+
+/* Reads the part of FILE_PAGE's file that backs a page into KVA and zeros
+ * the rest of the page. */
+static bool
+read_page (struct file_page *file_page, void *kva) {
+	bool ok = file_read_at (file_page->file, kva, file_page->read_bytes,
+			file_page->ofs) == (off_t) file_page->read_bytes;
+
+	memset (kva + file_page->read_bytes, 0, PGSIZE - file_page->read_bytes);
+	return ok;
+}
+
+/* Writes BYTES bytes of BUFFER to FILE_PAGE's file at its offset. */
+static bool
+write_file (const struct file_page *file_page, const void *buffer,
+		size_t bytes) {
+	return file_write_at (file_page->file, buffer, bytes, file_page->ofs)
+		== (off_t) bytes;
+}
+
+/* Loads a mapped page on its first fault.  AUX is the struct
+ * mmap_region that PAGE belongs to, whose file the page shares. */
+bool
+file_lazy_load (struct page *page, void *aux) {
+	struct mmap_region *region = aux;
 	struct file_page *file_page = &page->file;
+	size_t ofs = (uint8_t *) page->va - (uint8_t *) region->addr;
+	size_t left = ofs < region->file_bytes ? region->file_bytes - ofs : 0;
+
+	file_page->file = region->file;
+	file_page->ofs = region->ofs + ofs;
+	file_page->read_bytes = left < PGSIZE ? left : PGSIZE;
+
+	return read_page (file_page, page->frame->kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return read_page (&page->file, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.
+ * The evictor has already unmapped the page; its dirty bit is kept. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (!pml4_is_dirty (page->owner->pml4, page->va))
+		return true;
+
+	/* A system call pins the user pages it touches before it takes any
+	 * file system lock, and pinned frames are never chosen for eviction,
+	 * so no holder of the inode's lock can be waiting for the evictor. */
+	return write_file (file_page, page->frame->kva, file_page->read_bytes);
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * Its file belongs to its mapping. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (vm_pin_frame (page)) {
+		file_backed_writeback (page);
+		vm_unpin_frame (page);
+	}
+	vm_free_frame (page);
+}
+
+/* Writes PAGE, which must be resident, back to its file if it is dirty.
+ * The page stays mapped and is clean afterwards unless it is written
+ * again.  Returns false if the write fails. */
+bool
+file_backed_writeback (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (!pml4_is_dirty (pml4, page->va))
+		return true;
+
+	/* Clear the bit before writing, so that a store racing with the write
+	 * marks the page dirty again. */
+	pml4_set_dirty (pml4, page->va, false);
+	if (!write_file (file_page, page->frame->kva, file_page->read_bytes)) {
+		pml4_set_dirty (pml4, page->va, true);
+		return false;
+	}
+	return true;
+}
+
+/* Pins PAGE and returns true if it is a resident, dirty file page. */
+static bool
+pin_if_dirty (struct page *page) {
+	if (page == NULL || VM_TYPE (page->operations->type) != VM_FILE
+			|| !vm_pin_frame (page))
+		return false;
+	if (!pml4_is_dirty (page->owner->pml4, page->va)) {
+		vm_unpin_frame (page);
+		return false;
+	}
+	return true;
+}
+
+/* Most pages that writeback_range() combines into one write. */
+#define RUN_MAX 32
+
+/* Writes back the N pinned, dirty pages in RUN, which follow each other
+ * in their file, in a single vectored write straight from their frames,
+ * wherever those are in memory. */
+static bool
+write_run (struct page **run, size_t n) {
+	struct iovec iov[RUN_MAX];
+	size_t bytes = 0;
+
+	if (n == 1)
+		return file_backed_writeback (run[0]);
+
+	for (size_t i = 0; i < n; i++) {
+		struct page *page = run[i];
+		pml4_set_dirty (page->owner->pml4, page->va, false);
+		iov[i] = (struct iovec) { page->frame->kva, page->file.read_bytes };
+		bytes += page->file.read_bytes;
+	}
+	if (file_writev_at (run[0]->file.file, iov, n, run[0]->file.ofs)
+			!= (off_t) bytes) {
+		for (size_t i = 0; i < n; i++)
+			pml4_set_dirty (run[i]->owner->pml4, run[i]->va, true);
+		return false;
+	}
+	return true;
+}
+
+/* Returns true if PAGE can join a run that ends with PREV: PREV must be
+ * a whole page, and PAGE must follow it in the same file. */
+static bool
+run_continues (struct page *prev, struct page *page) {
+	return prev->file.file == page->file.file
+		&& prev->file.read_bytes == PGSIZE
+		&& prev->file.ofs + PGSIZE == page->file.ofs;
+}
+
+/* Writes back the dirty pages among the PAGE_CNT pages from START.
+ * Runs of dirty pages that are contiguous in the file are combined into
+ * writes of up to RUN_MAX pages. */
+static bool
+writeback_range (void *start, size_t page_cnt) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *run[RUN_MAX];
+	bool ok = true;
+	size_t i = 0;
+
+	while (i < page_cnt) {
+		size_t n = 0;
+
+		while (i < page_cnt && n < RUN_MAX) {
+			struct page *page = spt_find_page (spt, start + i * PGSIZE);
+
+			if (!pin_if_dirty (page)) {
+				if (n > 0)
+					break;
+				i++;
+				continue;
+			}
+			if (n > 0 && !run_continues (run[n - 1], page)) {
+				vm_unpin_frame (page);
+				break;
+			}
+			run[n++] = page;
+			i++;
+		}
+
+		if (n > 0 && !write_run (run, n))
+			ok = false;
+		for (size_t j = 0; j < n; j++)
+			vm_unpin_frame (run[j]);
+	}
+	return ok;
+}
+
+/* Returns the mapping of the current process that contains ADDR, or a
+ * null pointer. */
+struct mmap_region *
+mmap_find_region (void *addr) {
+	struct list *mmaps = &thread_current ()->spt.mmaps;
+	struct list_elem *e;
+
+	for (e = list_begin (mmaps); e != list_end (mmaps); e = list_next (e)) {
+		struct mmap_region *r = list_entry (e, struct mmap_region, elem);
+		if ((uint8_t *) addr >= (uint8_t *) r->addr
+				&& (uint8_t *) addr < (uint8_t *) r->addr + r->page_cnt * PGSIZE)
+			return r;
+	}
+	return NULL;
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	off_t file_len = file_length (file);
+	size_t i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || pg_ofs (offset) != 0
+			|| length == 0 || offset < 0 || file_len == 0
+			|| !is_user_vaddr (addr)
+			|| page_cnt > ((uint64_t) KERN_BASE - (uint64_t) addr) / PGSIZE)
+		return NULL;
+	/* Keep the stack free to grow, down to its guard page. */
+	if (vm_in_stack_region (addr)
+			|| vm_in_stack_region (addr + page_cnt * PGSIZE - 1)
+			|| ((uint64_t) addr < USER_STACK
+				&& (uint64_t) addr + page_cnt * PGSIZE > USER_STACK))
+		return NULL;
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, addr + i * PGSIZE) != NULL)
+			return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (file);
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+	region->addr = addr;
+	region->page_cnt = page_cnt;
+	region->ofs = offset;
+	region->file_bytes = offset < file_len ? file_len - offset : 0;
+
+	for (i = 0; i < page_cnt; i++)
+		if (!vm_alloc_page_with_initializer (VM_FILE, addr + i * PGSIZE,
+					writable, file_lazy_load, region)) {
+			while (i-- > 0)
+				spt_remove_page (spt, spt_find_page (spt, addr + i * PGSIZE));
+			file_close (region->file);
+			free (region);
+			return NULL;
+		}
+
+	list_push_back (&spt->mmaps, &region->elem);
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region = mmap_find_region (addr);
+
+	if (region == NULL || region->addr != addr)
+		return;
+
+	writeback_range (region->addr, region->page_cnt);
+	for (size_t i = 0; i < region->page_cnt; i++) {
+		void *va = addr + i * PGSIZE;
+		struct page *page = spt_find_page (spt, va);
+
+		/* A 2 MB page that the region covers goes whole, without being
+		 * split up first. */
+		if ((uint64_t) va % HPGSIZE == 0 && i + HPG_CNT <= region->page_cnt)
+			pml4_clear_huge_page (thread_current ()->pml4, va);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	list_remove (&region->elem);
+	file_close (region->file);
+	free (region);
+}
+
+/* Writes back the dirty mapped pages that overlap the LENGTH bytes at
+ * ADDR.  Returns 0 on success, -1 if the range is not entirely mapped or
+ * a write fails. */
+int
+do_msync (void *addr, size_t length) {
+	uint8_t *p = pg_round_down (addr);
+	uint8_t *end = (uint8_t *) addr + length;
+	bool ok = true;
+
+	if (end < p)
+		return -1;
+	while (p < end) {
+		struct mmap_region *region = mmap_find_region (p);
+		uint8_t *region_end;
+
+		if (region == NULL)
+			return -1;
+		region_end = (uint8_t *) region->addr + region->page_cnt * PGSIZE;
+		if (region_end > end)
+			region_end = pg_round_up (end);
+		if (!writeback_range (p, (region_end - p) / PGSIZE))
+			ok = false;
+		p = region_end;
+	}
+	return ok ? 0 : -1;
+}
+
+/* Copies the mappings of SRC into DST, each with its own reference to
+ * the file, before their pages are copied. */
+bool
+mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (&src->mmaps); e != list_end (&src->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *r = list_entry (e, struct mmap_region, elem);
+		struct mmap_region *copy = malloc (sizeof *copy);
+
+		if (copy == NULL)
+			return false;
+		*copy = *r;
+		copy->file = file_reopen (r->file);
+		if (copy->file == NULL) {
+			free (copy);
+			return false;
+		}
+		list_push_back (&dst->mmaps, &copy->elem);
+	}
+	return true;
+}
+
+/* Returns a new load_info, with a single reference, for the segment at
+ * UPAGE whose first READ_BYTES bytes come from offset OFS in FILE, which
+ * it reopens.  Returns a null pointer if memory runs out. */
+struct load_info *
+load_info_create (struct file *file, off_t ofs, void *upage,
+		size_t read_bytes) {
+	struct load_info *info = malloc (sizeof *info);
+	if (info == NULL)
+		return NULL;
+
+	info->file = file_reopen (file);
+	if (info->file == NULL) {
+		free (info);
+		return NULL;
+	}
+	info->upage = upage;
+	info->ofs = ofs;
+	info->read_bytes = read_bytes;
+	info->ref_cnt = 1;
+	return info;
+}
+
+/* Adds a reference to INFO and returns it. */
+struct load_info *
+load_info_ref (struct load_info *info) {
+	lock_acquire (&load_info_lock);
+	info->ref_cnt++;
+	lock_release (&load_info_lock);
+	return info;
+}
+
+/* Drops a reference to INFO, and closes its file and frees it if that
+ * was the last.  INFO may be null. */
+void
+load_info_unref (struct load_info *info) {
+	bool last;
+
+	if (info == NULL)
+		return;
+	lock_acquire (&load_info_lock);
+	last = --info->ref_cnt == 0;
+	lock_release (&load_info_lock);
+	if (last) {
+		file_close (info->file);
+		free (info);
+	}
 }
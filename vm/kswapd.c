@@ -0,0 +1,84 @@
+/* kswapd.c: Background page reclaim.
+ *
+ * The kswapd thread sleeps until the number of free user pool pages drops
+ * below the low watermark.  It then writes back dirty file-backed pages
+ * and evicts pages until the high watermark is reached, so that page
+ * faults normally find a free frame without doing any I/O themselves. */
+
+#include "vm/kswapd.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/vm.h"
+
+/* Watermarks as fractions of the user pool.  The low watermark is at
+ * least LOW_WMARK_MIN pages and the high one at least twice the low. */
+#define LOW_WMARK_DIV 64
+#define LOW_WMARK_MIN 4
+#define HIGH_WMARK_DIV 32
+
+/* Dirty pages written back on each wakeup. */
+#define CLEAN_BATCH 16
+
+static size_t low_wmark, high_wmark;
+
+/* Upped to wake kswapd.  AWAKE avoids piling up wakeups while it runs. */
+static struct semaphore kswapd_sema;
+static bool awake;
+
+/* Statistics. */
+static long long reclaim_cnt;   /* # of pages reclaimed. */
+static long long clean_cnt;     /* # of pages written back ahead of time. */
+
+static void kswapd (void *aux);
+
+/* Sets the watermarks from the size of the user pool and starts kswapd.
+ * Must be called before any user page is allocated. */
+void
+kswapd_init (void) {
+	size_t user_pages = palloc_free_cnt (PAL_USER);
+
+	low_wmark = user_pages / LOW_WMARK_DIV;
+	if (low_wmark < LOW_WMARK_MIN)
+		low_wmark = LOW_WMARK_MIN;
+	high_wmark = user_pages / HIGH_WMARK_DIV;
+	if (high_wmark < 2 * low_wmark)
+		high_wmark = 2 * low_wmark;
+
+	sema_init (&kswapd_sema, 0);
+	if (thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+		PANIC ("cannot start kswapd");
+}
+
+/* Wakes kswapd if free user pages are below the low watermark. */
+void
+kswapd_wakeup (void) {
+	if (!awake && palloc_free_cnt (PAL_USER) < low_wmark) {
+		awake = true;
+		sema_up (&kswapd_sema);
+	}
+}
+
+/* Prints kswapd statistics. */
+void
+kswapd_print_stats (void) {
+	printf ("kswapd: %lld pages reclaimed, %lld written back\n",
+			reclaim_cnt, clean_cnt);
+}
+
+/* Thread function for kswapd. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+
+		/* Clean first, so that the reclaim below can pick clean pages. */
+		clean_cnt += vm_clean_frames (CLEAN_BATCH);
+		while (palloc_free_cnt (PAL_USER) < high_wmark && vm_reclaim_frame ())
+			reclaim_cnt++;
+		awake = false;
+	}
+}
@@ -8,6 +8,8 @@
  * function.
  * */
 
+#include <string.h>
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/uninit.h"
 
@@ -51,7 +53,10 @@ uninit_initialize (struct page *page, void *kva) {
 	vm_initializer *init = uninit->init;
 	void *aux = uninit->aux;
 
-	/* TODO: You may need to fix this function. */
+	/* A page without an initializer has no contents of its own. */
+	if (init == NULL)
+		memset (kva, 0, PGSIZE);
+
 	return uninit->page_initializer (page, uninit->type, kva) &&
 		(init ? init (page, aux) : true);
 }
@@ -62,7 +67,10 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* A mapped page's AUX is its mapping, which outlives it. */
+	if (VM_TYPE (uninit->type) != VM_FILE)
+		load_info_unref (uninit->aux);
+	vm_free_frame (page);
 }
@@ -1,8 +1,59 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/evict.h"
+#include "vm/faultstat.h"
 #include "vm/inspect.h"
+#include "vm/kswapd.h"
+#include "intrinsic.h"
+
+/* Protects the eviction policy's frame queues and the page <-> frame
+ * links.  Held across a whole eviction, so a process faulting on a page
+ * that is being written out waits here until the write is done. */
+static struct lock frame_lock;
+
+/* Signaled, with FRAME_LOCK, whenever a frame is unpinned. */
+static struct condition frame_unpinned;
+
+/* Victims vm_evict_frame() tries before giving up. */
+#define EVICT_TRIES 8
+
+/* A process's working set is sampled every this many page faults. */
+#define WSS_SAMPLE_FAULTS 64
+
+/* Largest size of a user stack, in bytes.  The page just below the limit
+ * is a guard page that is never mapped.  Set with "-stack". */
+size_t vm_stack_limit = 1 << 20;
+
+/* Size in pages of the aligned window around a fault on a file-backed
+ * page whose other unloaded file-backed pages are loaded along with it.
+ * Set with "-faultaround"; 0 turns fault-around off. */
+size_t vm_fault_around = 16;
+
+/* Pages faulted in at once when the stack grows by more than a page,
+ * e.g. for a large local array. */
+#define STACK_PREFAULT_PAGES 8
+
+/* Huge pages are only set up while this many user pages would still be
+ * free afterwards, so that they do not crowd out everything else. */
+#define HUGE_MIN_FREE HPG_CNT
+
+/* Statistics. */
+static long long fault_cnt;     /* # of page faults resolved. */
+static long long evict_cnt;     /* # of frames evicted. */
+static long long huge_cnt;      /* # of huge pages mapped at fault time. */
+static long long promote_cnt;   /* # of windows promoted to huge pages. */
+static long long around_cnt;    /* # of pages loaded by fault-around. */
+
+/* A single read-only frame full of zeros.  Reads of untouched anonymous
+ * pages are mapped here, so a page only gets a real frame once written. */
+static void *zero_kva;
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +66,12 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	lock_init (&frame_lock);
+	cond_init (&frame_unpinned);
+	evict_init ();
+	zero_kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	kswapd_init ();
+	faultstat_init ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -36,6 +92,12 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static bool vm_is_zero_fill (struct page *page);
+static bool vm_map_zero_page (struct page *page);
+static bool vm_try_huge_claim (struct page *page);
+static void vm_try_promote (struct page *page);
+static bool is_unloaded_file_page (struct page *page);
+static void vm_fault_around_page (struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,11 +112,33 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
-
-		/* TODO: Insert the page into the spt. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+		page->zero_mapped = false;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +146,710 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page p;
+	struct hash_elem *e;
 
-	return page;
+	p.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &p.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
-	return true;
 }
 
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	ASSERT (lock_held_by_current_thread (&frame_lock));
 
-	return victim;
+	return evict_policy->reclaim ();
 }
 
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-
+	/* A victim may refuse to go, e.g. a dirty file page whose write-back
+	 * fails, so try a few. */
+	for (int tries = 0; tries < EVICT_TRIES; tries++) {
+		struct frame *victim = vm_get_victim ();
+		struct page *page;
+		uint64_t *pml4;
+		bool dirty;
+
+		if (victim == NULL)
+			return NULL;
+		page = victim->page;
+		pml4 = page->owner->pml4;
+
+		/* Unmap first, so the owner cannot change the page while it is
+		 * being written out.  A page of a 2 MB page that cannot be split
+		 * up for lack of memory has to stay. */
+		if (!pml4_clear_page (pml4, page->va)) {
+			evict_policy->fault (victim);
+			continue;
+		}
+		if (swap_out (page)) {
+			page->frame = NULL;
+			victim->page = NULL;
+			evict_cnt++;
+			return victim;
+		}
+
+		/* Map it back, keeping the dirty bit. */
+		dirty = pml4_is_dirty (pml4, page->va);
+		pml4_set_page (pml4, page->va, victim->kva, page->writable);
+		pml4_set_dirty (pml4, page->va, dirty);
+		evict_policy->fault (victim);
+	}
 	return NULL;
 }
 
+/* Clears the bookkeeping of FRAME, which is about to get a new page. */
+static void
+frame_reset (struct frame *frame) {
+	frame->page = NULL;
+	frame->queue = 0;
+	frame->referenced = false;
+	frame->pin_cnt = 0;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  Returns NULL only if the user pool is full and no frame
+ * could be evicted, e.g. because swap is full. */
 static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	void *kva;
+
+	lock_acquire (&frame_lock);
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		frame = vm_evict_frame ();
+	else {
+		frame = malloc (sizeof *frame);
+		if (frame == NULL)
+			PANIC ("out of memory for frame table");
+		frame->kva = kva;
+	}
+	lock_release (&frame_lock);
+	kswapd_wakeup ();
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	if (frame != NULL)
+		frame_reset (frame);
 	return frame;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr UNUSED) {
+/* Releases the frame held by PAGE, if any, and unmaps PAGE from its
+ * owner.  Called by the page destructors. */
+void
+vm_free_frame (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *frame;
+
+	if (page->zero_mapped) {
+		/* The zero frame is shared, never free it. */
+		pml4_clear_page (pml4, page->va);
+		page->zero_mapped = false;
+	}
+
+	/* Waits for an eviction of PAGE in progress, if any, and for whoever
+	 * pinned the frame to be done with it. */
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pin_cnt > 0)
+		cond_wait (&frame_unpinned, &frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		if (frame->queue != 0)
+			evict_policy->remove (frame);
+		if (pml4_clear_page (pml4, page->va))
+			palloc_free_page (frame->kva);
+		else {
+			/* No memory to split up the 2 MB page that PAGE is in: its
+			 * frame, which is free now, becomes the page table. */
+			pml4_split_huge_page (pml4, page->va, frame->kva);
+			pml4_clear_page (pml4, page->va);
+		}
+		free (frame);
+		page->frame = NULL;
+	}
+	lock_release (&frame_lock);
+}
+
+/* Evicts one frame and returns it to the user pool.  Returns false if
+ * there was nothing to evict. */
+bool
+vm_reclaim_frame (void) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = vm_evict_frame ();
+	lock_release (&frame_lock);
+	if (frame == NULL)
+		return false;
+
+	palloc_free_page (frame->kva);
+	free (frame);
+	return true;
+}
+
+/* Passed to collect_dirty(). */
+struct clean_batch {
+	struct page *pages[16];
+	size_t cnt;
+	size_t max;
+};
+
+/* Pins FRAME and adds its page to the batch if it is a dirty
+ * file-backed page. */
+static bool
+collect_dirty (struct frame *frame, void *aux) {
+	struct clean_batch *b = aux;
+	struct page *page = frame->page;
+
+	if (frame->pin_cnt > 0 || page_get_type (page) != VM_FILE
+			|| !pml4_is_dirty (page->owner->pml4, page->va))
+		return true;
+	frame->pin_cnt++;
+	b->pages[b->cnt++] = page;
+	return b->cnt < b->max;
+}
+
+/* Writes back up to MAX dirty file-backed pages, so that evicting them
+ * later needs no I/O.  The pages stay resident.  Returns the number of
+ * pages written. */
+size_t
+vm_clean_frames (size_t max) {
+	struct clean_batch b;
+	size_t written = 0;
+
+	b.cnt = 0;
+	b.max = max < sizeof b.pages / sizeof *b.pages
+		? max : sizeof b.pages / sizeof *b.pages;
+	if (b.max == 0)
+		return 0;
+
+	lock_acquire (&frame_lock);
+	evict_for_each_frame (collect_dirty, &b);
+	lock_release (&frame_lock);
+
+	/* The frames are pinned, so neither eviction nor the owner's exit
+	 * can take them away during the writes. */
+	for (size_t i = 0; i < b.cnt; i++)
+		if (file_backed_writeback (b.pages[i]))
+			written++;
+
+	for (size_t i = 0; i < b.cnt; i++)
+		vm_unpin_frame (b.pages[i]);
+	return written;
+}
+
+/* Pins the frame of PAGE, so that it stays resident until
+ * vm_unpin_frame().  Returns false, pinning nothing, if PAGE is not
+ * resident. */
+bool
+vm_pin_frame (struct page *page) {
+	bool resident;
+
+	lock_acquire (&frame_lock);
+	resident = page->frame != NULL;
+	if (resident)
+		page->frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return resident;
+}
+
+void
+vm_unpin_frame (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame->pin_cnt > 0);
+	if (--page->frame->pin_cnt == 0)
+		cond_broadcast (&frame_unpinned, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Like vm_pin_frame(), but brings PAGE in first if it is not resident.
+ * Returns false if PAGE cannot be brought in. */
+static bool
+vm_pin_page (struct page *page) {
+	/* Another process may evict it again before we pin it. */
+	while (!vm_pin_frame (page))
+		if (!vm_do_claim_page (page))
+			return false;
+	return true;
+}
+
+/* Passed to sample_pte(). */
+struct wss_sample {
+	struct thread *t;
+	size_t accessed;            /* # of pages found accessed. */
+};
+
+/* Reports the accessed bit of user PTE to the eviction policy and clears
+ * it. */
+static bool
+sample_pte (uint64_t *pte, void *va, void *aux) {
+	struct wss_sample *s = aux;
+	struct page *page;
+	bool accessed;
+
+	if (!is_user_pte (pte) || !is_user_vaddr (va))
+		return true;
+	page = spt_find_page (&s->t->spt, va);
+	if (page == NULL || page->frame == NULL)
+		return true;
+
+	/* A huge page's directory entry is seen once for each of its pages,
+	 * which all share its accessed bit: clear it after the last one. */
+	accessed = (*pte & PTE_A) != 0;
+	if (accessed) {
+		if (!(*pte & PTE_PS) || pg_no (va) % HPG_CNT == HPG_CNT - 1)
+			*pte &= ~(uint64_t) PTE_A;
+		s->accessed++;
+	}
+	evict_policy->sample (page->frame, accessed);
+	return true;
+}
+
+/* Samples the accessed bits of T's resident pages.  Each one is reported
+ * to the eviction policy and cleared, and the number that were set is
+ * T's new working set estimate. */
+void
+vm_sample_working_set (struct thread *t) {
+	struct wss_sample s = { .t = t, .accessed = 0 };
+
+	if (t->pml4 == NULL)
+		return;
+
+	lock_acquire (&frame_lock);
+	pml4_for_each (t->pml4, sample_pte, &s);
+	lock_release (&frame_lock);
+	t->wss = s.accessed;
+
+	/* The TLB may still hold entries whose accessed bit was set. */
+	if (t == thread_current ())
+		pml4_activate (t->pml4);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %lld faults, %lld evictions (%s policy)\n",
+			fault_cnt, evict_cnt, evict_policy->name);
+	printf ("VM: %lld huge pages faulted in, %lld promoted\n",
+			huge_cnt, promote_cnt);
+	printf ("VM: %lld pages loaded by fault-around\n", around_cnt);
+	faultstat_print (false);
+	anon_print_stats ();
+	kswapd_print_stats ();
+}
+
+/* Returns true if ADDR lies in the region reserved for the user stack,
+ * including its guard page. */
+bool
+vm_in_stack_region (const void *addr) {
+	uint64_t a = (uint64_t) addr;
+	return a < USER_STACK && a >= USER_STACK - vm_stack_limit - PGSIZE;
+}
+
+/* Returns true if a fault at ADDR looks like an access to the stack: at
+ * most 8 bytes below the user stack pointer (PUSH writes before moving
+ * RSP) and within the stack limit. */
+static bool
+vm_is_stack_access (struct intr_frame *f, void *addr, bool user) {
+	/* A fault in the kernel happens inside a system call, so use the rsp
+	 * saved on entry rather than the kernel's. */
+	uint64_t rsp = user ? f->rsp : thread_current ()->user_rsp;
+	uint64_t a = (uint64_t) addr;
+
+	return a >= rsp - 8 && a < USER_STACK
+		&& a >= USER_STACK - vm_stack_limit;
+}
+
+/* Growing the stack.  Adds stack pages from ADDR up to the current
+ * bottom of the stack and faults in the lowest few, since a frame that
+ * skips pages is about to touch them. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *bottom = pg_round_down (addr);
+	void *va;
+	size_t n;
+
+	for (va = bottom; va < (void *) USER_STACK && spt_find_page (spt, va) == NULL;
+			va += PGSIZE)
+		if (!vm_alloc_page (VM_ANON | VM_STACK, va, true))
+			return false;
+
+	for (n = 0; bottom < va && n < STACK_PREFAULT_PAGES;
+			bottom += PGSIZE, n++)
+		if (!vm_claim_page (bottom))
+			return n > 0;
+	return true;
 }
 
 /* Handle the fault on write_protected page */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	if (!page->writable)
+		return false;
+
+	if (page->zero_mapped) {
+		/* First write to a page backed by the zero frame: give it a
+		 * private frame now. */
+		pml4_clear_page (thread_current ()->pml4, page->va);
+		page->zero_mapped = false;
+		return vm_do_claim_page (page);
+	}
+	return false;
 }
 
-/* Return true on success */
+/* The kernel runs with CR0.WP clear, so its writes ignore read-only
+ * mappings: a system call writing to a read-only page, or to one mapped
+ * to the shared zero frame, would not fault.  These functions ready user
+ * pages for the kernel, which leaves everything else to the page fault
+ * handler. */
+
+/* Readies the user page at VA of the running process for a write by
+ * the kernel.  Returns false if the page is read-only.  A page that is
+ * not in the supplemental page table is left to the page fault
+ * handler. */
+bool
+vm_prepare_user_write (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
+
+	if (page == NULL)
+		return true;
+	if (!page->writable)
+		return false;
+	return !page->zero_mapped || vm_handle_wp (page);
+}
+
+/* Pins the user page at VA of the running process, bringing it in
+ * first, so that the kernel can access it while holding locks that the
+ * page fault handler may need.  Grows the stack if VA is just below it.
+ * If WRITE, the page must be writable.  Returns false if there is no
+ * such page or it cannot be brought in. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_pin_user_page (void *va, bool write) {
+	struct thread *t = thread_current ();
+	struct page *page = spt_find_page (&t->spt, va);
+
+	if (page == NULL && vm_is_stack_access (NULL, va, false)
+			&& vm_stack_growth (va))
+		page = spt_find_page (&t->spt, va);
+	if (page == NULL || (write && !page->writable))
+		return false;
+	if (page->zero_mapped) {
+		/* Pin a private frame, not the shared zero frame. */
+		pml4_clear_page (t->pml4, page->va);
+		page->zero_mapped = false;
+	}
+	return vm_pin_page (page);
+}
+
+/* Unpins the user page at VA pinned by vm_pin_user_page(). */
+void
+vm_unpin_user_page (void *va) {
+	vm_unpin_frame (spt_find_page (&thread_current ()->spt, va));
+}
+
+/* Returns true if PAGE is an untouched anonymous page whose contents
+ * would be all zeros, e.g. the BSS or fresh anonymous memory. */
+static bool
+vm_is_zero_fill (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Maps PAGE read-only to the shared zero frame. */
+static bool
+vm_map_zero_page (struct page *page) {
+	if (!pml4_set_page (thread_current ()->pml4, page->va, zero_kva, false))
+		return false;
+	page->zero_mapped = true;
+	return true;
+}
+
+/* Returns how a fault on PAGE, which is not mapped, will be resolved. */
+static enum fault_kind
+fault_kind (struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			return vm_is_zero_fill (page) ? FAULT_ANON : FAULT_UNINIT;
+		case VM_ANON:
+			return FAULT_SWAP_IN;
+		default:
+			return FAULT_FILE;
+	}
+}
+
+/* Resolves a page fault, setting *KIND to how. */
+static bool
+handle_fault (struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present, enum fault_kind *kind) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	bool around;
 
-	return vm_do_claim_page (page);
+	*kind = FAULT_INVALID;
+	if (addr == NULL || is_kernel_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		*kind = FAULT_STACK;
+		return vm_is_stack_access (f, addr, user) && vm_stack_growth (addr);
+	}
+
+	/* A present page only faults on a write to a read-only mapping. */
+	if (!not_present) {
+		*kind = FAULT_COW;
+		return write && vm_handle_wp (page);
+	}
+
+	if (write && !page->writable)
+		return false;
+
+	/* Fast path: the page got mapped since the access, e.g. because its
+	 * eviction was refused.  Nothing to allocate and no lock to take. */
+	*kind = FAULT_MINOR;
+	if (pml4_get_page (t->pml4, page->va) != NULL)
+		return true;
+
+	/* The page is being evicted: wait for that to finish.  If the page
+	 * stays, it is mapped again. */
+	if (page->frame != NULL && vm_pin_frame (page)) {
+		vm_unpin_frame (page);
+		return true;
+	}
+
+	*kind = fault_kind (page);
+	if (++t->vm_fault_cnt % WSS_SAMPLE_FAULTS == 0)
+		vm_sample_working_set (t);
+
+	/* Reading a page that was never written yields zeros, so share the
+	 * zero frame until the first write. */
+	if (!write && vm_is_zero_fill (page))
+		return vm_map_zero_page (page);
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& vm_try_huge_claim (page))
+		return true;
+	around = is_unloaded_file_page (page);
+	if (!vm_do_claim_page (page))
+		return false;
+	if (around)
+		vm_fault_around_page (page);
+	vm_try_promote (page);
+	return true;
+}
+
+/* Returns true if PAGE is backed by a file, an executable or a mapped
+ * one, and not loaded. */
+static bool
+is_unloaded_file_page (struct page *page) {
+	if (page->frame != NULL || page->zero_mapped)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.init != NULL;
+	return VM_TYPE (page->operations->type) == VM_FILE;
+}
+
+/* Fault-around.  PAGE was just loaded from a file: load the other
+ * unloaded file-backed pages in the vm_fault_around pages window around
+ * it too, so that a sequential sweep faults once per window.  Stops
+ * before it would have to evict anything. */
+static void
+vm_fault_around_page (struct page *page) {
+	struct thread *t = page->owner;
+	size_t window = vm_fault_around * PGSIZE;
+	void *start, *va;
+
+	if (vm_fault_around < 2)
+		return;
+	start = (void *) ((uint64_t) page->va / window * window);
+	for (va = start; va < start + window; va += PGSIZE) {
+		struct page *p;
+
+		if (va == page->va || !is_user_vaddr (va))
+			continue;
+		if (palloc_free_cnt (PAL_USER) <= 2 * vm_fault_around)
+			break;
+		p = spt_find_page (&t->spt, va);
+		if (p != NULL && is_unloaded_file_page (p)
+				&& pml4_get_page (t->pml4, va) == NULL
+				&& vm_do_claim_page (p))
+			around_cnt++;
+	}
+}
+
+/* Return true on success */
+bool
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	uint64_t start = rdtsc ();
+	enum fault_kind kind;
+	bool success;
+
+	fault_cnt++;
+	success = handle_fault (f, addr, user, write, not_present, &kind);
+	faultstat_record (success ? kind : FAULT_INVALID, start);
+	return success;
+}
+
+/* Returns the start of the 2 MB window that VA lies in. */
+static void *
+huge_base (const void *va) {
+	return (void *) ((uint64_t) va & ~(HPGSIZE - 1));
+}
+
+/* Returns true if CAND, a page in the same 2 MB window as PAGE, can be
+ * faulted in as part of the same huge page: it must be of the same kind
+ * and not loaded yet. */
+static bool
+huge_candidate (struct page *cand, struct page *page) {
+	return cand != NULL
+		&& VM_TYPE (cand->operations->type) == VM_UNINIT
+		&& VM_TYPE (cand->uninit.type) == VM_TYPE (page->uninit.type)
+		&& cand->writable == page->writable
+		&& !cand->zero_mapped;
+}
+
+/* Tries to fault in the whole 2 MB window around PAGE, which is not
+ * loaded yet, as a single huge page.  Every page of the window must be
+ * like PAGE, and the user pool must have an aligned run to spare.
+ * Returns true if PAGE got mapped, which is as a small page if the huge
+ * page could not be completed. */
+static bool
+vm_try_huge_claim (struct page *page) {
+	struct thread *t = page->owner;
+	void *base = huge_base (page->va);
+	void *kva;
+	size_t i, n;
+
+	if (palloc_free_cnt (PAL_USER) < HPG_CNT + HUGE_MIN_FREE)
+		return false;
+	for (i = 0; i < HPG_CNT; i++)
+		if (!huge_candidate (spt_find_page (&t->spt, base + i * PGSIZE), page))
+			return false;
+	kva = palloc_get_aligned (PAL_USER, HPG_CNT, HPG_CNT);
+	if (kva == NULL)
+		return false;
+
+	/* Load each page at its place in the run.  None of the frames is
+	 * known to the eviction policy yet, so none can be taken away. */
+	for (n = 0; n < HPG_CNT; n++) {
+		struct page *p = spt_find_page (&t->spt, base + n * PGSIZE);
+		struct frame *frame = malloc (sizeof *frame);
+
+		if (frame == NULL)
+			break;
+		frame_reset (frame);
+		frame->kva = kva + n * PGSIZE;
+		frame->page = p;
+		p->frame = frame;
+		if (!swap_in (p, frame->kva)) {
+			p->frame = NULL;
+			free (frame);
+			break;
+		}
+	}
+
+	if (n == HPG_CNT && pml4_set_huge_page (t->pml4, base, kva,
+				page->writable))
+		huge_cnt++;
+	else {
+		/* Keep what was loaded, as small pages. */
+		palloc_free_multiple (kva + n * PGSIZE, HPG_CNT - n);
+		for (i = 0; i < n; i++) {
+			struct page *p = spt_find_page (&t->spt, base + i * PGSIZE);
+			if (!pml4_set_page (t->pml4, p->va, p->frame->kva, p->writable))
+				vm_free_frame (p);
+		}
+	}
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < n; i++) {
+		struct page *p = spt_find_page (&t->spt, base + i * PGSIZE);
+		if (p->frame != NULL)
+			evict_policy->fault (p->frame);
+	}
+	lock_release (&frame_lock);
+	kswapd_wakeup ();
+	return page->frame != NULL;
+}
+
+/* Returns true if CAND, a page in the same 2 MB window as PAGE, can be
+ * moved into a huge page along with it.  A dirty file page cannot, since
+ * the huge page has a single dirty bit. */
+static bool
+promote_candidate (struct page *cand, struct page *page) {
+	return cand != NULL && cand->frame != NULL
+		&& cand->frame->pin_cnt == 0 && cand->frame->queue != 0
+		&& VM_TYPE (cand->operations->type)
+			== VM_TYPE (page->operations->type)
+		&& cand->writable == page->writable
+		&& (page_get_type (cand) != VM_FILE
+			|| !pml4_is_dirty (cand->owner->pml4, cand->va));
+}
+
+/* Moves the 2 MB window around PAGE, which was just faulted in, to a
+ * huge page if all its pages are resident.  Only tried when PAGE is the
+ * first or last page of the window, which is where a sweep through the
+ * window ends. */
+static void
+vm_try_promote (struct page *page) {
+	struct thread *t = page->owner;
+	void *base = huge_base (page->va);
+	size_t idx = pg_no (page->va) % HPG_CNT;
+	void *kva;
+	size_t i;
+
+	if ((idx != 0 && idx != HPG_CNT - 1)
+			|| palloc_free_cnt (PAL_USER) < HPG_CNT + HUGE_MIN_FREE)
+		return;
+
+	/* Holding the lock keeps the frames from being evicted or pinned
+	 * while they move. */
+	lock_acquire (&frame_lock);
+	for (i = 0; i < HPG_CNT; i++)
+		if (!promote_candidate (spt_find_page (&t->spt, base + i * PGSIZE),
+					page))
+			goto done;
+	kva = palloc_get_aligned (PAL_USER, HPG_CNT, HPG_CNT);
+	if (kva == NULL)
+		goto done;
+
+	for (i = 0; i < HPG_CNT; i++) {
+		struct frame *frame = spt_find_page (&t->spt, base + i * PGSIZE)->frame;
+		memcpy (kva + i * PGSIZE, frame->kva, PGSIZE);
+	}
+	if (!pml4_set_huge_page (t->pml4, base, kva, page->writable)) {
+		palloc_free_multiple (kva, HPG_CNT);
+		goto done;
+	}
+	for (i = 0; i < HPG_CNT; i++) {
+		struct frame *frame = spt_find_page (&t->spt, base + i * PGSIZE)->frame;
+		palloc_free_page (frame->kva);
+		frame->kva = kva + i * PGSIZE;
+	}
+	promote_cnt++;
+done:
+	lock_release (&frame_lock);
 }
 
 /* Free the page.
@@ -150,9 +862,10 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -162,29 +875,139 @@ static bool
 vm_do_claim_page (struct page *page) {
 	struct frame *frame = vm_get_frame ();
 
+	if (frame == NULL)
+		return false;
+
 	/* Set links */
 	frame->page = page;
 	page->frame = frame;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_free_frame (page);
+		return false;
+	}
+
+	lock_acquire (&frame_lock);
+	evict_policy->fault (frame);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Hashes a page by its user virtual address. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *p = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&p->va, sizeof p->va);
+}
 
-	return swap_in (page, frame->kva);
+/* Orders pages by their user virtual address. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	const struct page *pa = hash_entry (a, struct page, spt_elem);
+	const struct page *pb = hash_entry (b, struct page, spt_elem);
+	return pa->va < pb->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	list_init (&spt->mmaps);
+}
+
+/* Copies SRC_PAGE of the parent into the current process. */
+static bool
+copy_page (struct page *src_page) {
+	void *va = src_page->va;
+	bool writable = src_page->writable;
+	struct page *dst_page;
+
+	/* A file page of the child maps the same part of the file through
+	 * the child's copy of the mapping. */
+	if (page_get_type (src_page) == VM_FILE) {
+		if (!vm_alloc_page_with_initializer (VM_FILE, va, writable,
+					file_lazy_load, mmap_find_region (va)))
+			return false;
+		if (VM_TYPE (src_page->operations->type) == VM_UNINIT)
+			return true;
+	} else if (VM_TYPE (src_page->operations->type) == VM_UNINIT) {
+		/* Not loaded yet: the child loads it on its own first fault,
+		 * from the segment it shares with the parent.  A page that only
+		 * maps the zero frame is still uninit too. */
+		struct load_info *aux = src_page->uninit.aux;
+		if (aux != NULL)
+			load_info_ref (aux);
+		if (!vm_alloc_page_with_initializer (src_page->uninit.type, va,
+					writable, src_page->uninit.init, aux)) {
+			load_info_unref (aux);
+			return false;
+		}
+		return true;
+	} else if (!vm_alloc_page (page_get_type (src_page), va, writable))
+		return false;
+
+	/* The parent's page may be on swap, and either copy may be evicted
+	 * while the other is brought in, so pin both. */
+	dst_page = spt_find_page (&thread_current ()->spt, va);
+	if (!vm_pin_page (src_page))
+		return false;
+	if (!vm_pin_page (dst_page)) {
+		vm_unpin_frame (src_page);
+		return false;
+	}
+	memcpy (dst_page->frame->kva, src_page->frame->kva, PGSIZE);
+	vm_unpin_frame (dst_page);
+	vm_unpin_frame (src_page);
+	return true;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	/* The mappings come first, for the file pages to refer to. */
+	if (!mmap_copy (dst, src))
+		return false;
+	hash_first (&i, &src->pages);
+	while (hash_next (&i))
+		if (!copy_page (hash_entry (hash_cur (&i), struct page, spt_elem)))
+			return false;
+	return true;
+}
+
+/* Destroys the page of hash element E. */
+static void
+spt_destroy_page (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
+}
+
+/* Removes the 2 MB page that the page of hash element E lies in, if
+ * any, from its owner's page table as a whole. */
+static void
+spt_clear_huge_page (struct hash_elem *e, void *aux UNUSED) {
+	struct page *page = hash_entry (e, struct page, spt_elem);
+
+	if (page->frame != NULL)
+		pml4_clear_huge_page (page->owner->pml4, page->va);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Unmapping writes dirty mapped pages back in batches. */
+	while (!list_empty (&spt->mmaps))
+		do_munmap (list_entry (list_front (&spt->mmaps), struct mmap_region,
+					elem)->addr);
+
+	/* Every page goes, so drop 2 MB pages whole rather than split them up
+	 * to free their pages one at a time. */
+	hash_apply (&spt->pages, spt_clear_huge_page);
+	hash_destroy (&spt->pages, spt_destroy_page);
 }